@@ -0,0 +1,316 @@
+//
+// KissDatasetGenerator - A generator of datasets for TorchKissAnn
+// Copyright (C) 2025 Carl Klemm <carl@uvos.xyz>
+//
+// This file is part of KissDatasetGenerator.
+//
+// KissDatasetGenerator is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// KissDatasetGenerator is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with KissDatasetGenerator.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+#include <thread>
+#include <atomic>
+#include <memory>
+#include <filesystem>
+#include <kisstype/spectra.h>
+
+#include "spectraparser.h"
+#include "mappedfile.h"
+#include "microtar.h"
+#include "tarwriter.h"
+#include "log.h"
+#include "datasets/eisgendatanoise.h"
+#include "datasets/passfaildataset.h"
+
+/*
+ * Throughput benchmarks for the hot paths of an export. Run without arguments to run
+ * all of them or give the names of the benchmarks to run.
+ */
+
+struct Benchmark
+{
+	const char* name;
+	const char* description;
+	void (*run)();
+};
+
+template <typename Func>
+static double seconds(Func func)
+{
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	func();
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+static std::string makeCsv(size_t points, size_t labelCount)
+{
+	std::vector<eis::DataPoint> data;
+	for(size_t i = 0; i < points; ++i)
+		data.push_back(eis::DataPoint(std::complex<fvalue>(100.0/(i+1), -1e-3*i*i), std::pow(10.0, i*7.0/points)));
+	eis::Spectra spectra(data, "r{1.5e2}-r{3.3e3}c{1.2e-6}", "");
+	for(size_t i = 0; i < labelCount; ++i)
+		spectra.addLabel("label" + std::to_string(i), i*0.5);
+
+	std::stringstream ss;
+	spectra.saveToStream(ss);
+	return ss.str();
+}
+
+static void benchParser()
+{
+	constexpr size_t COUNT = 20000;
+	std::string csv = makeCsv(100, 10);
+
+	double slow = seconds([&csv]()
+	{
+		for(size_t i = 0; i < COUNT; ++i)
+		{
+			MemoryStream ss(csv.data(), csv.size());
+			eis::Spectra spectra = eis::Spectra::loadFromStream(ss);
+		}
+	});
+	double fast = seconds([&csv]()
+	{
+		for(size_t i = 0; i < COUNT; ++i)
+			eis::Spectra spectra = parseSpectra(csv.data(), csv.size());
+	});
+	double header = seconds([&csv]()
+	{
+		for(size_t i = 0; i < COUNT; ++i)
+		{
+			eis::Spectra spectra;
+			parseSpectraHeader(csv.data(), csv.size(), spectra);
+		}
+	});
+
+	std::cout<<"loadFromStream:    "<<COUNT/slow<<" spectra/s\n";
+	std::cout<<"parseSpectra:      "<<COUNT/fast<<" spectra/s\n";
+	std::cout<<"parseSpectraHeader: "<<COUNT/header<<" spectra/s\n";
+}
+
+static std::string memberName(size_t i)
+{
+	return "r-rc_" + std::to_string(i*7919ull) + ".csv";
+}
+
+static void reportTar(const char* name, const std::filesystem::path& path, double time)
+{
+	double mb = std::filesystem::file_size(path)/1e6;
+	std::cout<<name<<mb/time<<" MB/s ("<<mb<<" MB in "<<time<<" s)\n";
+	std::filesystem::remove(path);
+	std::filesystem::remove(TarIndex::indexPath(path));
+}
+
+static void benchTar()
+{
+	constexpr size_t COUNT = 200000;
+	const std::string data = makeCsv(100, 0);
+	const std::filesystem::path path = std::filesystem::temp_directory_path()/"kissdatasetgenerator-bench.tar";
+	size_t threadCount = std::max(std::thread::hardware_concurrency(), 1u);
+
+	// the writer used before TarWriter, one stdio write per header and payload
+	double time = seconds([&]()
+	{
+		mtar_t tar;
+		mtar_open(&tar, path.c_str(), "w");
+		for(size_t i = 0; i < COUNT; ++i)
+		{
+			mtar_write_file_header(&tar, memberName(i).c_str(), data.size());
+			mtar_write_data(&tar, data.data(), data.size());
+		}
+		mtar_finalize(&tar);
+		mtar_close(&tar);
+	});
+	reportTar("microtar:                       ", path, time);
+
+	time = seconds([&]()
+	{
+		TarWriter writer(path);
+		for(size_t i = 0; i < COUNT; ++i)
+			writer.writeFile(memberName(i), data);
+		writer.finalize();
+	});
+	reportTar("TarWriter:                      ", path, time);
+
+	time = seconds([&]()
+	{
+		TarWriter writer(path);
+		BufferedTarWriter buffered(&writer);
+		for(size_t i = 0; i < COUNT; ++i)
+			buffered.writeFile(memberName(i), data);
+		buffered.flush();
+		writer.finalize();
+	});
+	reportTar("BufferedTarWriter:              ", path, time);
+
+	time = seconds([&]()
+	{
+		TarWriter writer(path);
+		std::vector<std::thread> threads;
+		for(size_t t = 0; t < threadCount; ++t)
+		{
+			threads.push_back(std::thread([&writer, &data, t, threadCount]()
+			{
+				for(size_t i = t; i < COUNT; i += threadCount)
+					writer.writeFile(memberName(i), data);
+			}));
+		}
+		for(std::thread& thread : threads)
+			thread.join();
+		writer.finalize();
+	});
+	reportTar("TarWriter, all threads:         ", path, time);
+
+	time = seconds([&]()
+	{
+		TarWriter writer(path);
+		std::vector<std::thread> threads;
+		for(size_t t = 0; t < threadCount; ++t)
+		{
+			threads.push_back(std::thread([&writer, &data, t, threadCount]()
+			{
+				BufferedTarWriter buffered(&writer);
+				for(size_t i = t; i < COUNT; i += threadCount)
+					buffered.writeFile(memberName(i), data);
+				buffered.flush();
+			}));
+		}
+		for(std::thread& thread : threads)
+			thread.join();
+		writer.finalize();
+	});
+	reportTar("BufferedTarWriter, all threads: ", path, time);
+}
+
+// Results are written here so that the compiler can not drop the work being timed
+static volatile size_t sink;
+
+static void benchLookup()
+{
+	constexpr size_t COUNT = 10000000;
+	Log::level = Log::WARN;
+
+	for(size_t modelCount : {1, 10, 100, 1000, 10000, 100000})
+	{
+		// Models without sweeps are added without evaluateing them, so building the
+		// dataset is cheap and only the index lookup is timed
+		std::stringstream circuits;
+		for(size_t i = 0; i < modelCount; ++i)
+			circuits<<"r{"<<i+1<<"}\n";
+		EisGeneratorDataset dataset(EisGeneratorDataset::getDefaultOptionValues(), circuits, 100);
+
+		// Random indices, so that the lookups can not be predicted from the previous one
+		size_t sum = 0;
+		uint64_t state = 1;
+		size_t size = dataset.size();
+		double time = seconds([&]()
+		{
+			for(size_t i = 0; i < COUNT; ++i)
+			{
+				state = state*6364136223846793005ull + 1442695040888963407ull;
+				sum += dataset.classForIndex((state >> 16) % size);
+			}
+		});
+		sink = sum;
+		std::cout<<modelCount<<" models: "<<time*1e9/COUNT<<" ns per lookup\n";
+	}
+}
+
+static void benchPassFail()
+{
+	constexpr size_t COUNT = 100000;
+	Log::level = Log::WARN;
+
+	std::stringstream circuits;
+	circuits<<"r{20~1000}-r{10~500}c{1e-6~1e-3}\n";
+	circuits<<"r{20~1000}-r{10~500}c{1e-6~1e-3}-r{10~500}c{1e-6~1e-3}\n";
+	circuits<<"r{20~1000}-r{10~500}p{1e-6~1e-3, 0.5~0.9}\n";
+	EisGeneratorDataset gendataset(EisGeneratorDataset::getDefaultOptionValues(), circuits, 100);
+	PassFaillDataset dataset(&gendataset);
+
+	// Like the exporter every thread works on its own copy of the dataset and a contiguous range of indices
+	size_t maxThreads = std::max(std::thread::hardware_concurrency(), 1u);
+	std::vector<size_t> threadCounts;
+	for(size_t threadCount = 1; threadCount < maxThreads; threadCount *= 2)
+		threadCounts.push_back(threadCount);
+	threadCounts.push_back(maxThreads);
+
+	double singleThreaded = 0;
+	for(size_t threadCount : threadCounts)
+	{
+		std::atomic<size_t> generated = 0;
+		double time = seconds([&]()
+		{
+			std::vector<std::thread> threads;
+			for(size_t t = 0; t < threadCount; ++t)
+			{
+				threads.push_back(std::thread([&dataset, &generated, t, threadCount]()
+				{
+					std::unique_ptr<EisDataset> copy(dataset.clone());
+					size_t count = 0;
+					for(size_t i = t*COUNT/threadCount; i < (t+1)*COUNT/threadCount; ++i)
+						count += !copy->get(i % copy->size()).data.empty();
+					generated += count;
+				}));
+			}
+			for(std::thread& thread : threads)
+				thread.join();
+		});
+
+		double rate = generated/time;
+		if(threadCount == 1)
+			singleThreaded = rate;
+		std::cout<<threadCount<<" threads: "<<rate<<" samples/s, "<<rate/singleThreaded<<"x\n";
+	}
+}
+
+static const std::vector<Benchmark> benchmarks = {
+	{"parser", "spectra per second of the csv parsers for 100 point spectra", benchParser},
+	{"tar", "MB/s of the tar writers for 200000 100 point spectra", benchTar},
+	{"lookup", "time per index to model lookup of the generator dataset as the model list grows", benchLookup},
+	{"passfail", "samples per second of the passfail dataset over 100 frequencies as threads are added", benchPassFail},
+};
+
+int main(int argc, char** argv)
+{
+	bool found = argc < 2;
+	for(const Benchmark& benchmark : benchmarks)
+	{
+		bool selected = argc < 2;
+		for(int i = 1; i < argc; ++i)
+			selected = selected || strcmp(argv[i], benchmark.name) == 0;
+		if(!selected)
+			continue;
+
+		found = true;
+		std::cout<<benchmark.name<<": "<<benchmark.description<<'\n';
+		benchmark.run();
+	}
+
+	if(!found)
+	{
+		std::cerr<<"Available benchmarks:\n";
+		for(const Benchmark& benchmark : benchmarks)
+			std::cerr<<'\t'<<benchmark.name<<": "<<benchmark.description<<'\n';
+		return 1;
+	}
+	return 0;
+}
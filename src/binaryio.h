@@ -0,0 +1,194 @@
+/* * KissDatasetGenerator - A generator of datasets for TorchKissAnn
+ * Copyright (C) 2025 Carl Klemm <carl@uvos.xyz>
+ *
+ * This file is part of KissDatasetGenerator.
+ *
+ * KissDatasetGenerator is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * KissDatasetGenerator is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with KissDatasetGenerator.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <string>
+
+/*
+ * Helpers for the binary index and cache files, all integers are stored
+ * little endian regardless of the host.
+ */
+
+inline void putU32(std::string& out, uint32_t value)
+{
+	for(size_t i = 0; i < sizeof(value); ++i)
+		out.push_back(static_cast<char>(value >> (i*8)));
+}
+
+inline void putU64(std::string& out, uint64_t value)
+{
+	for(size_t i = 0; i < sizeof(value); ++i)
+		out.push_back(static_cast<char>(value >> (i*8)));
+}
+
+inline void putString(std::string& out, const std::string& str)
+{
+	putU32(out, str.size());
+	out.append(str);
+}
+
+// LEB128 style variable length encoding, small values take a single byte
+inline void putVarint(std::string& out, uint64_t value)
+{
+	while(value >= 0x80)
+	{
+		out.push_back(static_cast<char>((value & 0x7f) | 0x80));
+		value >>= 7;
+	}
+	out.push_back(static_cast<char>(value));
+}
+
+template <typename Float>
+inline void putFloat(std::string& out, Float value)
+{
+	static_assert(sizeof(Float) == sizeof(uint32_t) || sizeof(Float) == sizeof(uint64_t));
+	if constexpr(sizeof(Float) == sizeof(uint32_t))
+	{
+		uint32_t bits;
+		std::memcpy(&bits, &value, sizeof(bits));
+		putU32(out, bits);
+	}
+	else
+	{
+		uint64_t bits;
+		std::memcpy(&bits, &value, sizeof(bits));
+		putU64(out, bits);
+	}
+}
+
+/*
+ * Bounds checked reader for data written with the functions above.
+ * Reading past the end sets the fail flag and returns zero values.
+ */
+class BinaryReader
+{
+	const char* data;
+	size_t size;
+	size_t pos = 0;
+	bool failed = false;
+
+	bool have(size_t bytes)
+	{
+		if(failed || size - pos < bytes)
+			failed = true;
+		return !failed;
+	}
+
+	template <typename Int>
+	Int readInt()
+	{
+		Int value = 0;
+		if(!have(sizeof(value)))
+			return 0;
+		for(size_t i = 0; i < sizeof(value); ++i)
+			value |= static_cast<Int>(static_cast<unsigned char>(data[pos++])) << (i*8);
+		return value;
+	}
+
+public:
+	BinaryReader(const char* data, size_t size): data(data), size(size) {}
+
+	uint32_t u32()
+	{
+		return readInt<uint32_t>();
+	}
+
+	uint64_t u64()
+	{
+		return readInt<uint64_t>();
+	}
+
+	uint64_t varint()
+	{
+		uint64_t value = 0;
+		for(unsigned shift = 0; shift < 64; shift += 7)
+		{
+			if(!have(1))
+				return 0;
+			unsigned char byte = static_cast<unsigned char>(data[pos++]);
+			value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+			if(!(byte & 0x80))
+				return value;
+		}
+		failed = true;
+		return 0;
+	}
+
+	template <typename Float>
+	Float f()
+	{
+		Float value;
+		if constexpr(sizeof(Float) == sizeof(uint32_t))
+		{
+			uint32_t bits = u32();
+			std::memcpy(&value, &bits, sizeof(value));
+		}
+		else
+		{
+			uint64_t bits = u64();
+			std::memcpy(&value, &bits, sizeof(value));
+		}
+		return value;
+	}
+
+	std::string string()
+	{
+		uint32_t len = u32();
+		if(!have(len))
+			return std::string();
+		std::string str(data + pos, len);
+		pos += len;
+		return str;
+	}
+
+	// Checks that the next bytes equal expected and skips them
+	bool expect(const char* expected, size_t len)
+	{
+		if(!have(len) || std::memcmp(data + pos, expected, len) != 0)
+			failed = true;
+		else
+			pos += len;
+		return !failed;
+	}
+
+	bool skip(size_t bytes)
+	{
+		if(have(bytes))
+			pos += bytes;
+		return !failed;
+	}
+
+	size_t position() const
+	{
+		return pos;
+	}
+
+	bool fail() const
+	{
+		return failed;
+	}
+
+	bool atEnd() const
+	{
+		return pos == size;
+	}
+};
@@ -0,0 +1,69 @@
+/* * KissDatasetGenerator - A generator of datasets for TorchKissAnn
+ * Copyright (C) 2025 Carl Klemm <carl@uvos.xyz>
+ *
+ * This file is part of KissDatasetGenerator.
+ *
+ * KissDatasetGenerator is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * KissDatasetGenerator is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with KissDatasetGenerator.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+#include <atomic>
+#include <algorithm>
+#include <cstddef>
+
+/*
+ * Hands out small contiguous index ranges from a shared atomic cursor so that
+ * threads that draw cheap samples simply come back for more work instead of
+ * idleing while a straggler grinds through an expensive part of the dataset.
+ */
+class ChunkScheduler
+{
+	std::atomic<size_t> cursor = 0;
+	size_t count;
+	size_t chunkSize;
+
+public:
+	static constexpr size_t CHUNKS_PER_THREAD = 16;
+	static constexpr size_t MAX_CHUNK_SIZE = 256;
+
+	ChunkScheduler(size_t count, size_t threadCount):
+	count(count)
+	{
+		chunkSize = std::clamp<size_t>(count/(std::max<size_t>(threadCount, 1)*CHUNKS_PER_THREAD), 1, MAX_CHUNK_SIZE);
+	}
+
+	bool next(size_t& begin, size_t& end)
+	{
+		begin = cursor.fetch_add(chunkSize, std::memory_order_relaxed);
+		if(begin >= count)
+			return false;
+		end = std::min(begin + chunkSize, count);
+		return true;
+	}
+
+	size_t done() const
+	{
+		return std::min(cursor.load(std::memory_order_relaxed), count);
+	}
+
+	size_t size() const
+	{
+		return count;
+	}
+
+	size_t getChunkSize() const
+	{
+		return chunkSize;
+	}
+};
@@ -0,0 +1,248 @@
+//
+// KissDatasetGenerator - A generator of datasets for TorchKissAnn
+// Copyright (C) 2025 Carl Klemm <carl@uvos.xyz>
+//
+// This file is part of KissDatasetGenerator.
+//
+// KissDatasetGenerator is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// KissDatasetGenerator is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with KissDatasetGenerator.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "dircache.h"
+
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <system_error>
+
+#include "../log.h"
+#include "../hash.h"
+#include "../binaryio.h"
+#include "../paramcache.h"
+
+static constexpr char MAGIC[8] = {'K', 'D', 'G', 'D', 'C', 'A', 'C', 'H'};
+
+std::filesystem::path DirCache::pathFor(const std::filesystem::path& directory, bool recursive)
+{
+	std::filesystem::path dir = paramcache::getCacheDir();
+	if(dir.empty())
+		return dir;
+	dir /= "dircache";
+
+	std::error_code ec;
+	std::filesystem::create_directories(dir, ec);
+	if(ec)
+	{
+		Log(Log::WARN)<<"Could not create cache directory "<<dir<<": "<<ec.message();
+		return std::filesystem::path();
+	}
+
+	// A recursive scan sees a different set of files, so it gets its own cache
+	std::string key = directory.string() + (recursive ? "\n1" : "\n0");
+	std::stringstream ss;
+	ss<<std::hex<<std::setw(16)<<std::setfill('0')<<murmurHash64(key.data(), key.size(), 0)<<".cache";
+	return dir/ss.str();
+}
+
+bool DirCache::load(const std::filesystem::path& path, const std::filesystem::path& directory)
+{
+	entries.clear();
+	lookup.clear();
+	map.reset();
+
+	if(!std::filesystem::exists(path))
+		return false;
+
+	std::shared_ptr<const MappedFile> file = std::make_shared<const MappedFile>(path);
+	if(!file->isOpen())
+		return false;
+
+	BinaryReader reader(file->data(), file->size());
+	if(!reader.expect(MAGIC, sizeof(MAGIC)) || reader.u32() != VERSION || reader.u32() != sizeof(fvalue))
+	{
+		Log(Log::WARN)<<path<<" is not a cache of a supported version, ignoreing it";
+		return false;
+	}
+	if(reader.string() != directory.string())
+	{
+		Log(Log::DEBUG)<<path<<" belongs to a different directory, ignoreing it";
+		return false;
+	}
+	withData = reader.u32();
+
+	uint64_t count = reader.u64();
+	for(uint64_t i = 0; i < count && !reader.fail(); ++i)
+	{
+		Entry entry;
+		entry.path = reader.string();
+		entry.size = reader.u64();
+		entry.mtime = static_cast<int64_t>(reader.u64());
+		entry.model = reader.string();
+		entry.header = reader.string();
+		entry.labelNames.resize(reader.u32());
+		for(std::string& name : entry.labelNames)
+			name = reader.string();
+		entry.labels.resize(reader.u32());
+		for(fvalue& label : entry.labels)
+			label = reader.f<fvalue>();
+		if(withData)
+		{
+			entry.dataCount = reader.u64();
+			entry.dataOffset = reader.position();
+			if(entry.dataCount > file->size() || !reader.skip(entry.dataCount*3*sizeof(fvalue)))
+				break;
+		}
+		if(reader.fail())
+			break;
+		lookup.insert({entry.path, entries.size()});
+		entries.push_back(std::move(entry));
+	}
+
+	if(reader.fail() || entries.size() != count || !reader.atEnd())
+	{
+		Log(Log::WARN)<<path<<" is corrupt, ignoreing it";
+		entries.clear();
+		lookup.clear();
+		return false;
+	}
+
+	map = file;
+	return true;
+}
+
+bool DirCache::save(const std::filesystem::path& path, const std::filesystem::path& directory, const std::vector<Entry>& newEntries,
+	const std::vector<std::vector<eis::DataPoint>>& data, bool saveData) const
+{
+	std::filesystem::path tmpPath = path.string() + ".tmp";
+	std::ofstream file(tmpPath, std::ios::binary | std::ios::trunc);
+	if(!file.is_open())
+	{
+		Log(Log::WARN)<<"Could not write cache "<<tmpPath;
+		return false;
+	}
+
+	std::string out(MAGIC, sizeof(MAGIC));
+	putU32(out, VERSION);
+	putU32(out, sizeof(fvalue));
+	putString(out, directory.string());
+	putU32(out, saveData);
+	putU64(out, newEntries.size());
+
+	for(size_t i = 0; i < newEntries.size(); ++i)
+	{
+		const Entry& entry = newEntries[i];
+		putString(out, entry.path);
+		putU64(out, entry.size);
+		putU64(out, static_cast<uint64_t>(entry.mtime));
+		putString(out, entry.model);
+		putString(out, entry.header);
+		putU32(out, entry.labelNames.size());
+		for(const std::string& name : entry.labelNames)
+			putString(out, name);
+		putU32(out, entry.labels.size());
+		for(fvalue label : entry.labels)
+			putFloat(out, label);
+
+		if(saveData)
+		{
+			std::vector<eis::DataPoint> cached;
+			const std::vector<eis::DataPoint>* points = &cached;
+			if(i < data.size() && !data[i].empty())
+				points = &data[i];
+			else
+				cached = getData(entry);
+
+			putU64(out, points->size());
+			for(const eis::DataPoint& point : *points)
+			{
+				putFloat(out, point.omega);
+				putFloat(out, point.im.real());
+				putFloat(out, point.im.imag());
+			}
+		}
+
+		// Keep memory use bounded for large directories
+		if(out.size() > 1024*1024)
+		{
+			file.write(out.data(), out.size());
+			out.clear();
+		}
+	}
+	file.write(out.data(), out.size());
+	file.close();
+
+	if(!file)
+	{
+		Log(Log::WARN)<<"Could not write cache "<<tmpPath;
+		return false;
+	}
+
+	std::error_code ec;
+	std::filesystem::rename(tmpPath, path, ec);
+	if(ec)
+	{
+		Log(Log::WARN)<<"Could not write cache "<<path<<": "<<ec.message();
+		std::filesystem::remove(tmpPath, ec);
+		return false;
+	}
+	return true;
+}
+
+const DirCache::Entry* DirCache::find(const std::string& path, uint64_t size, int64_t mtime) const
+{
+	auto search = lookup.find(path);
+	if(search == lookup.end())
+		return nullptr;
+	const Entry& entry = entries[search->second];
+	if(entry.size != size || entry.mtime != mtime)
+		return nullptr;
+	return &entry;
+}
+
+const std::vector<DirCache::Entry>& DirCache::getEntries() const
+{
+	return entries;
+}
+
+bool DirCache::includesData() const
+{
+	return withData && map;
+}
+
+std::vector<eis::DataPoint> DirCache::getData(const Entry& entry) const
+{
+	std::vector<eis::DataPoint> points;
+	if(!includesData())
+		return points;
+
+	BinaryReader reader(map->data() + entry.dataOffset, entry.dataCount*3*sizeof(fvalue));
+	points.reserve(entry.dataCount);
+	for(uint64_t i = 0; i < entry.dataCount; ++i)
+	{
+		fvalue omega = reader.f<fvalue>();
+		fvalue real = reader.f<fvalue>();
+		fvalue imag = reader.f<fvalue>();
+		points.push_back(eis::DataPoint(std::complex<fvalue>(real, imag), omega));
+	}
+	return points;
+}
+
+eis::Spectra DirCache::getSpectra(const Entry& entry) const
+{
+	eis::Spectra spectra;
+	spectra.data = getData(entry);
+	spectra.model = entry.model;
+	spectra.header = entry.header;
+	spectra.setLabels(entry.labels);
+	spectra.labelNames = entry.labelNames;
+	return spectra;
+}
@@ -0,0 +1,83 @@
+/* * KissDatasetGenerator - A generator of datasets for TorchKissAnn
+ * Copyright (C) 2025 Carl Klemm <carl@uvos.xyz>
+ *
+ * This file is part of KissDatasetGenerator.
+ *
+ * KissDatasetGenerator is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * KissDatasetGenerator is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with KissDatasetGenerator.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <filesystem>
+#include <kisstype/spectra.h>
+
+#include "../mappedfile.h"
+
+/*
+ * On disk cache of the metadata, and optionally the data points, of the spectra in a
+ * directory. Entries are keyed by the path relative to the directory, the file size and
+ * the modification time, so only files that where added or changed need to be parsed again.
+ * Data points are read directly from a memory mapping of the cache file.
+ * Cache files live in the dircache subdirectory of paramcache::getCacheDir(), named after a
+ * hash of the absolute path of the directory, which is also stored in the file and checked on load.
+ */
+class DirCache
+{
+public:
+	struct Entry
+	{
+		std::string path;
+		uint64_t size = 0;
+		int64_t mtime = 0;
+		std::string model;
+		std::string header;
+		std::vector<std::string> labelNames;
+		std::vector<fvalue> labels;
+		// position and count of the data points in the cache file, if stored
+		uint64_t dataOffset = 0;
+		uint64_t dataCount = 0;
+	};
+
+private:
+	std::vector<Entry> entries;
+	std::unordered_map<std::string, size_t> lookup;
+	std::shared_ptr<const MappedFile> map;
+	bool withData = false;
+
+public:
+	static constexpr uint32_t VERSION = 2;
+
+	// Returns the path of the cache file for directory, or an empty path if no cache directory can be determined
+	static std::filesystem::path pathFor(const std::filesystem::path& directory, bool recursive);
+
+	bool load(const std::filesystem::path& path, const std::filesystem::path& directory);
+
+	// Writes entries to path, the data points of entry i are taken from data[i] or,
+	// if that is empty, from this cache
+	bool save(const std::filesystem::path& path, const std::filesystem::path& directory, const std::vector<Entry>& entries,
+		const std::vector<std::vector<eis::DataPoint>>& data, bool withData) const;
+
+	// Returns the entry for path if it is still valid for a file of this size and mtime
+	const Entry* find(const std::string& path, uint64_t size, int64_t mtime) const;
+	const std::vector<Entry>& getEntries() const;
+	bool includesData() const;
+	std::vector<eis::DataPoint> getData(const Entry& entry) const;
+	// Builds the full spectrum of an entry, requires the cache to include data
+	eis::Spectra getSpectra(const Entry& entry) const;
+};
@@ -21,12 +21,16 @@
 #include "dirloader.h"
 
 #include <algorithm>
+#include <atomic>
 #include <assert.h>
 #include <kisstype/type.h>
 #include <eisgenerator/translators.h>
 
 #include "model.h"
 #include "../log.h"
+#include "../spectraparser.h"
+#include "../parallelfor.h"
+#include "dircache.h"
 
 #include "filterdata.h"
 
@@ -36,6 +40,9 @@ inputSize(inputSize), selectLabels(selectLabels), extraInputs(extraInputs)
 	assert(options.size() == getOptions().size());
 
 	normalization = options[0];
+	recursive = options[1];
+	bool useCache = options[2] || options[3];
+	bool cacheData = options[3];
 
 	const std::filesystem::path directoryPath{dirName};
 	if(!std::filesystem::is_directory(dirName))
@@ -44,91 +51,212 @@ inputSize(inputSize), selectLabels(selectLabels), extraInputs(extraInputs)
 		return;
 	}
 
-	for(const std::filesystem::directory_entry& dirent : std::filesystem::directory_iterator{directoryPath})
+	std::vector<std::filesystem::path> paths;
+	auto addEntry = [&paths](const std::filesystem::directory_entry& dirent)
 	{
-		if(!dirent.is_regular_file() || dirent.path().extension() != ".csv")
-			continue;
-		Log(Log::DEBUG)<<"Using: "<<dirent.path().filename();
-		eis::Spectra spectra = eis::Spectra::loadFromDisk(dirent.path());
+		if(dirent.is_regular_file() && dirent.path().extension() == ".csv")
+			paths.push_back(dirent.path());
+	};
+	if(recursive)
+	{
+		for(const std::filesystem::directory_entry& dirent : std::filesystem::recursive_directory_iterator{directoryPath})
+			addEntry(dirent);
+	}
+	else
+	{
+		for(const std::filesystem::directory_entry& dirent : std::filesystem::directory_iterator{directoryPath})
+			addEntry(dirent);
+	}
 
-		bool fail = false;
-		for(const std::string& key : selectLabels)
+	// The iteration order is unspecified, sort so that indices and classes are reproducible
+	std::sort(paths.begin(), paths.end());
+
+	std::error_code ec;
+	const std::filesystem::path absolutePath = std::filesystem::absolute(directoryPath, ec).lexically_normal();
+	std::filesystem::path cachePath;
+	if(useCache)
+	{
+		cachePath = DirCache::pathFor(absolutePath, recursive);
+		useCache = !cachePath.empty();
+		cacheData = cacheData && useCache;
+	}
+
+	std::shared_ptr<DirCache> dirCache = std::make_shared<DirCache>();
+	if(useCache)
+		dirCache->load(cachePath, absolutePath);
+	bool reuseData = dirCache->includesData();
+
+	// Files not in the cache are parsed, only their metadata unless the data is cached too,
+	// spread over all cores
+	std::vector<DirCache::Entry> entries(paths.size());
+	std::vector<std::vector<eis::DataPoint>> data(cacheData ? paths.size() : 0);
+	std::vector<char> valid(paths.size(), false);
+	std::atomic<size_t> parsed = 0;
+	parallelFor(paths.size(), [&](size_t i)
+	{
+		try
 		{
-			if(!spectra.hasLabel(key))
+			DirCache::Entry& entry = entries[i];
+			entry.path = paths[i].lexically_relative(directoryPath).string();
+			entry.size = std::filesystem::file_size(paths[i]);
+			entry.mtime = std::filesystem::last_write_time(paths[i]).time_since_epoch().count();
+
+			const DirCache::Entry* cached = useCache ? dirCache->find(entry.path, entry.size, entry.mtime) : nullptr;
+			if(cached && (!cacheData || reuseData))
 			{
-				Log(Log::DEBUG)<<"Dsicarding as it is missing: "<<key;
-				fail = true;
-				break;
+				entry = *cached;
+			}
+			else
+			{
+				eis::Spectra spectra = cacheData ? loadSpectraFile(paths[i]) : loadSpectraFileHeader(paths[i]);
+				entry.model = std::move(spectra.model);
+				entry.header = std::move(spectra.header);
+				entry.labelNames = std::move(spectra.labelNames);
+				entry.labels.assign(spectra.labels.begin(), spectra.labels.end());
+				entry.dataOffset = 0;
+				entry.dataCount = 0;
+				if(cacheData)
+					data[i] = std::move(spectra.data);
+				++parsed;
 			}
+			valid[i] = true;
 		}
-		if(fail)
-			continue;
+		catch(const eis::file_error& err)
+		{
+			Log(Log::WARN)<<"Can't load datafile from "<<paths[i]<<' '<<err.what();
+		}
+		catch(const std::filesystem::filesystem_error& err)
+		{
+			Log(Log::WARN)<<"Can't load datafile from "<<paths[i]<<' '<<err.what();
+		}
+	});
 
-		for(const std::string& key : extraInputs)
+	std::vector<size_t> validIndices;
+	for(size_t i = 0; i < paths.size(); ++i)
+	{
+		if(valid[i])
+			validIndices.push_back(i);
+	}
+	Log(Log::INFO)<<"Parsed "<<parsed<<" of "<<validIndices.size()<<" files in "<<directoryPath;
+
+	if(useCache && (parsed > 0 || validIndices.size() != dirCache->getEntries().size()))
+	{
+		std::vector<DirCache::Entry> newEntries;
+		std::vector<std::vector<eis::DataPoint>> newData;
+		newEntries.reserve(validIndices.size());
+		for(size_t i : validIndices)
 		{
-			if(!spectra.hasLabel(key))
-			{
-				Log(Log::DEBUG)<<"Dsicarding as it is missing: "<<key;
-				fail = true;
-				break;
-			}
-			continue;
+			newEntries.push_back(std::move(entries[i]));
+			if(cacheData)
+				newData.push_back(std::move(data[i]));
 		}
-		if(fail)
+
+		if(dirCache->save(cachePath, absolutePath, newEntries, newData, cacheData))
+			dirCache->load(cachePath, absolutePath);
+		entries = std::move(newEntries);
+	}
+	else
+	{
+		std::vector<DirCache::Entry> newEntries;
+		newEntries.reserve(validIndices.size());
+		for(size_t i : validIndices)
+			newEntries.push_back(std::move(entries[i]));
+		entries = std::move(newEntries);
+	}
+	data.clear();
+
+	if(cacheData && dirCache->includesData())
+		cache = dirCache;
+
+	FileTable& files = fileTable();
+	for(size_t i = 0; i < validIndices.size(); ++i)
+	{
+		const DirCache::Entry& entry = entries[i];
+		if(!hasRequiredLabels(entry.labelNames))
 			continue;
 
-		eis::purgeEisParamBrackets(spectra.model);
-		eis::Model::removeSeriesResitance(spectra.model);
-		if(spectra.model.length() < 2 && spectra.model != "r" && spectra.model != "c" && spectra.model != "w" && spectra.model != "p" && spectra.model != "l")
-			spectra.model = "Union";
-		auto search = std::find(modelStrs.begin(), modelStrs.end(), spectra.model);
-		size_t index;
-		if(search == modelStrs.end())
+		std::string model = entry.model;
+		eis::purgeEisParamBrackets(model);
+		eis::Model::removeSeriesResitance(model);
+		if(model.length() < 2 && model != "r" && model != "c" && model != "w" && model != "p" && model != "l")
+			model = "Union";
+
+		size_t cacheIndex = NO_CACHE_ENTRY;
+		if(cache)
 		{
-			index = modelStrs.size();
-			modelStrs.push_back(spectra.model);
-			Log(Log::DEBUG)<<"New model "<<index<<": "<<spectra.model;
+			const DirCache::Entry* cached = cache->find(entry.path, entry.size, entry.mtime);
+			if(cached)
+				cacheIndex = cached - cache->getEntries().data();
 		}
-		else
+		files.fileNames.push_back({paths[validIndices[i]], classForModel(model), cacheIndex});
+	}
+
+	Log(Log::DEBUG)<<"Using "<<files.fileNames.size()<<" of "<<paths.size()<<" files in "<<directoryPath;
+	if(files.fileNames.size() < 20)
+		Log(Log::WARN)<<"found few valid files in "<<directoryPath;
+}
+
+EisDirDataset::FileTable& EisDirDataset::fileTable()
+{
+	if(table.use_count() > 1)
+		table = std::make_shared<FileTable>(*table);
+	return *table;
+}
+
+size_t EisDirDataset::classForModel(const std::string& model)
+{
+	FileTable& files = fileTable();
+	auto search = files.modelIds.find(model);
+	if(search != files.modelIds.end())
+		return search->second;
+
+	size_t index = files.modelStrs.size();
+	files.modelStrs.push_back(model);
+	files.modelIds.insert({model, index});
+	Log(Log::DEBUG)<<"New model "<<index<<": "<<model;
+	return index;
+}
+
+bool EisDirDataset::hasRequiredLabels(const std::vector<std::string>& labelNames) const
+{
+	for(const std::vector<std::string>* keys : {&selectLabels, &extraInputs})
+	{
+		for(const std::string& key : *keys)
 		{
-			index = search - modelStrs.begin();
+			if(std::find(labelNames.begin(), labelNames.end(), key) == labelNames.end())
+			{
+				Log(Log::DEBUG)<<"Dsicarding as it is missing: "<<key;
+				return false;
+			}
 		}
-		fileNames.push_back({dirent.path(), index});
 	}
-	if(fileNames.size() < 20)
-		Log(Log::WARN)<<"found few valid files in "<<directoryPath;
+	return true;
 }
 
 size_t EisDirDataset::removeLessThan(size_t examples)
 {
-	std::vector<size_t> classCounts(modelStrs.size(), 0);
-	for(FileNameStr file : fileNames)
+	FileTable& files = fileTable();
+	std::vector<size_t> classCounts(files.modelStrs.size(), 0);
+	for(const FileNameStr& file : files.fileNames)
 		++classCounts[file.classNum];
 
-	size_t removed = 0;
-
 	Log(Log::DEBUG)<<"Class counts for removal:";
 	for(size_t i =  0; i < classCounts.size(); ++i)
-		Log(Log::DEBUG)<<modelStrs[i]<<": "<<classCounts[i]<<(classCounts[i] < examples ? "(removed)" : "");
+		Log(Log::DEBUG)<<files.modelStrs[i]<<": "<<classCounts[i]<<(classCounts[i] < examples ? "(removed)" : "");
 	Log(Log::DEBUG, false)<<'\n';
 
-	for(size_t i = 0; i < fileNames.size(); ++i)
-	{
-		if(classCounts[fileNames[i].classNum] < examples)
-		{
-			fileNames.erase(fileNames.begin()+i);
-			--i;
-			++removed;
-		}
-	}
+	auto last = std::remove_if(files.fileNames.begin(), files.fileNames.end(),
+		[&classCounts, examples](const FileNameStr& file){return classCounts[file.classNum] < examples;});
+	size_t removed = std::distance(last, files.fileNames.end());
+	files.fileNames.erase(last, files.fileNames.end());
 
-	classCounts.assign(modelStrs.size(), 0);
-	for(FileNameStr file : fileNames)
+	classCounts.assign(files.modelStrs.size(), 0);
+	for(const FileNameStr& file : files.fileNames)
 		++classCounts[file.classNum];
 
 	Log(Log::DEBUG)<<"Class counts after removal:";
 	for(size_t i =  0; i < classCounts.size(); ++i)
-		Log(Log::DEBUG)<<modelStrs[i]<<": "<<classCounts[i]<<(classCounts[i] < examples ? "(removed)" : "");
+		Log(Log::DEBUG)<<files.modelStrs[i]<<": "<<classCounts[i]<<(classCounts[i] < examples ? "(removed)" : "");
 	Log(Log::DEBUG, false)<<'\n';
 
 	return removed;
@@ -136,33 +264,30 @@ size_t EisDirDataset::removeLessThan(size_t examples)
 
 eis::Spectra EisDirDataset::getImpl(size_t index)
 {
-	if(fileNames.size() < index)
+	if(index >= table->fileNames.size())
 	{
 		Log(Log::ERROR)<<"index "<<index<<" out of range in "<<__func__;
 		assert(false);
 		return {};
 	}
 
+	const FileNameStr& file = table->fileNames[index];
 	eis::Spectra data;
 
 	try
 	{
-		data = eis::Spectra::loadFromDisk(fileNames[index].path);
+		if(cache && file.cacheIndex != NO_CACHE_ENTRY)
+			data = cache->getSpectra(cache->getEntries()[file.cacheIndex]);
+		else
+			data = loadSpectraFile(file.path);
 		eis::purgeEisParamBrackets(data.model);
 		eis::Model::removeSeriesResitance(data.model);
-		assert(modelStrs[fileNames[index].classNum] == data.model);
+		assert(table->modelStrs[file.classNum] == data.model);
 	}
 	catch(const eis::file_error& err)
 	{
-		Log(Log::WARN)<<"Can't load datafile from "<<fileNames[index].path<<' '<<err.what();
-		if(index != 0)
-		{
-			if(index+1 < size())
-				return get(index+1);
-			else
-				return get(0);
-		}
-		assert(false);
+		Log(Log::WARN)<<"Can't load datafile from "<<file.path<<' '<<err.what();
+		return eis::Spectra();
 	}
 
 	filterData(data.data, inputSize, normalization);
@@ -183,35 +308,38 @@ eis::Spectra EisDirDataset::getImpl(size_t index)
 
 size_t EisDirDataset::classForIndex(size_t index)
 {
-	return fileNames[index].classNum;
+	return table->fileNames[index].classNum;
 }
 
 size_t EisDirDataset::size() const
 {
-	return fileNames.size();
+	return table->fileNames.size();
 }
 
 std::string EisDirDataset::modelStringForClass(size_t classNum)
 {
-	if(classNum >= modelStrs.size())
+	if(classNum >= table->modelStrs.size())
 		return "invalid";
 	else
-		return *std::next(modelStrs.begin(), classNum);
+		return table->modelStrs[classNum];
 }
 
 std::string EisDirDataset::getOptionsHelp()
 {
 	std::stringstream ss;
 	ss<<"normalization: Normalize the spectra\n";
+	ss<<"recursive: Also load spectra from subdirectories\n";
+	ss<<"cache: Keep the metadata of the spectra in a cache file under $XDG_CACHE_HOME/kissdatasetgenerator/dircache, so that only new or changed files are parsed on the next run\n";
+	ss<<"cachedata: Also keep the data points in the cache and load spectra from it instead of parseing the files\n";
 	return ss.str();
 }
 
 std::vector<std::string> EisDirDataset::getOptions()
 {
-	return {"normalization"};
+	return {"normalization", "recursive", "cache", "cachedata"};
 }
 
 std::vector<int> EisDirDataset::getDefaultOptionValues()
 {
-	return {false};
+	return {false, false, true, false};
 }
@@ -22,36 +22,57 @@
 #include <cstdint>
 #include <vector>
 #include <string>
+#include <memory>
+#include <unordered_map>
 #include <filesystem>
 #include <kisstype/spectra.h>
 
 #include "eisdataset.h"
+#include "dircache.h"
 
 
 class EisDirDataset : public EisDataset
 {
 private:
 
+	static constexpr size_t NO_CACHE_ENTRY = static_cast<size_t>(-1);
+
 	struct FileNameStr
 	{
 		std::filesystem::path path;
 		size_t classNum;
+		size_t cacheIndex = NO_CACHE_ENTRY;
+	};
+
+	// The file table is shared between all copies of the dataset,
+	// modifying it via fileTable() first makes this copy the sole owner
+	struct FileTable
+	{
+		std::vector<EisDirDataset::FileNameStr> fileNames;
+		std::vector<std::string> modelStrs;
+		std::unordered_map<std::string, size_t> modelIds;
 	};
+	std::shared_ptr<FileTable> table = std::make_shared<FileTable>();
 
-	std::vector<EisDirDataset::FileNameStr> fileNames;
 	size_t inputSize;
-	std::vector<std::string> modelStrs;
 	std::vector<std::string> selectLabels;
 	std::vector<std::string> extraInputs;
 	bool normalization;
+	bool recursive;
+	// Shared between copies, only set if spectra are loaded from the cache
+	std::shared_ptr<const DirCache> cache;
 
 	virtual eis::Spectra getImpl(size_t index) override;
+	size_t classForModel(const std::string& model);
+	FileTable& fileTable();
+	bool hasRequiredLabels(const std::vector<std::string>& labelNames) const;
 
 public:
 	explicit EisDirDataset(const std::vector<int>& options, const std::string& dirName, int64_t inputSize = 100, std::vector<std::string> selectLabels = {}, std::vector<std::string> extraInputs = {});
 	EisDirDataset(const EisDirDataset& in) = default;
 
 	virtual size_t size() const override;
+	virtual EisDataset* clone() const override {return new EisDirDataset(*this);}
 
 	virtual size_t classForIndex(size_t index) override;
 	virtual std::string modelStringForClass(size_t classNum) override;
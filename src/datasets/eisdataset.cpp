@@ -25,3 +25,10 @@ eis::Spectra EisDataset::get(size_t index)
 	eis::Spectra data = getImpl(index);
 	return data;
 }
+
+void EisDataset::getBatch(size_t begin, size_t end, SpectraBatch& batch)
+{
+	batch.clear();
+	for(size_t i = begin; i < end; ++i)
+		batch.append(i, get(i));
+}
@@ -23,6 +23,8 @@
 #include <vector>
 #include <kisstype/spectra.h>
 
+#include "spectrabatch.h"
+
 class EisDataset
 {
 private:
@@ -30,10 +32,21 @@ private:
 
 public:
 	eis::Spectra get(size_t index);
+	// Replaces the contents of batch with the samples in [begin, end)
+	virtual void getBatch(size_t begin, size_t end, SpectraBatch& batch);
 	virtual size_t size() const = 0;
+	// Returns a new copy of the dataset that can be used from another thread
+	virtual EisDataset* clone() const = 0;
+	// Indices in [size(), candidateCount()) are spare candidates that are only exported
+	// in place of rejected samples, datasets that can not oversample have none
+	virtual size_t candidateCount() const {return size();}
 	virtual size_t classForIndex(size_t index) = 0;
+	// Makes get() draw its random numbers from another set of streams, so that a dataset
+	// wrapping this one can use a sample twice with independent noise
+	virtual void setStreamVariant(uint64_t variant) {}
 	virtual std::string modelStringForClass(size_t classNum) {return std::string("Unkown");}
 	virtual std::string getDescription() {return "";};
+	virtual std::string getStatistics() {return "";};
 	virtual ~EisDataset(){}
 
 	static std::string getOptionsHelp() {return "";}
@@ -27,11 +27,17 @@
 #include <eisgenerator/basicmath.h>
 #include <sstream>
 #include <fstream>
+#include <iomanip>
 #include <algorithm>
+#include <mutex>
+#include <thread>
 
 #include "spectra.h"
 #include "tokenize.h"
+#include "randomgen.h"
 #include "../log.h"
+#include "../parallelfor.h"
+#include "../paramcache.h"
 
 static std::vector<std::string> readCircutsFromStream(std::istream& ss)
 {
@@ -48,6 +54,37 @@ static std::vector<std::string> readCircutsFromStream(std::istream& ss)
 	return out;
 }
 
+// Describes every input of eis::Model::getRecommendedParamIndices, the parameter
+// strings of the first and last sweep step capture the sweep ranges
+static std::string paramCacheKey(eis::Model& model, size_t steps, const eis::Range& omega, double threshold)
+{
+	std::stringstream ss;
+	ss<<std::setprecision(17);
+	ss<<model.getModelStr()<<'\n';
+	ss<<model.getModelStrWithParam(0)<<'\n';
+	ss<<model.getModelStrWithParam(steps-1)<<'\n';
+	ss<<steps<<'\n';
+	ss<<omega.start<<' '<<omega.end<<' '<<omega.count<<' '<<omega.log<<'\n';
+	ss<<threshold<<'\n';
+	return ss.str();
+}
+
+static std::string sweepModelKey(eis::Model& model, size_t steps)
+{
+	std::stringstream ss;
+	ss<<model.getModelStr()<<'\n';
+	ss<<model.getModelStrWithParam(0)<<'\n';
+	ss<<model.getModelStrWithParam(steps-1)<<'\n';
+	ss<<steps;
+	return ss.str();
+}
+
+static void addWhiteNoise(std::vector<eis::DataPoint>& data, double amplitude, rd::Generator& generator)
+{
+	for(eis::DataPoint& dataPoint : data)
+		dataPoint.im += std::complex<fvalue>(generator.normal()*amplitude, generator.normal()*amplitude);
+}
+
 EisGeneratorDataset::EisGeneratorDataset(const std::vector<int>& options, int64_t outputSize):
 omega(10, 1e6, outputSize/2, true)
 {
@@ -56,6 +93,9 @@ omega(10, 1e6, outputSize/2, true)
 	normalize = !options[1];
 	useEisNoise = !options[2];
 	grid = options[3];
+	useParamCache = !options[4];
+	if(options[5])
+		sweepStore = SweepStore::openDefault();
 }
 
 EisGeneratorDataset::EisGeneratorDataset(const std::vector<int>& options, std::istream& is, int64_t outputSize):
@@ -96,28 +136,31 @@ void EisGeneratorDataset::addVectorOfModels(const std::vector<std::string>& mode
 	if(sizePerModel < 200)
 		sizePerModel = 200;
 
-	for(const std::string& modelStr : modelStrs)
+	// Parsing and finding the interesting parameters of each model is independent of the
+	// others, the results are inserted in list order afterwards.
+	// getRecommendedParamIndices can spawn a thread per core itself, which must not happen
+	// on several parallelFor threads at once. With few models, like the handfull in the noise lists, one
+	// model per thread would leave most cores idle, so the models are then prepared one
+	// after the other with the threaded search instead.
+	std::vector<ModelData> prepared(modelStrs.size());
+	size_t cores = std::max(std::thread::hardware_concurrency(), 1u);
+	bool threadedSearch = modelStrs.size()*2 <= cores;
+	parallelFor(modelStrs.size(), [&](size_t i)
 	{
-		std::string workModelStr = stripWhitespace(modelStr);
+		std::string workModelStr = stripWhitespace(modelStrs[i]);
 		if(workModelStr.empty())
-			continue;
+			return;
 
 		std::shared_ptr<eis::Model> model(new eis::Model(workModelStr));
 		if(model->getRequiredStepsForSweeps() > 1)
 			model->setParamSweepCountClosestTotal(sizePerModel);
-		addModel(model, sizePerModel);
-	}
-	Log(Log::INFO)<<__func__<<" dataset now has "<<size()<<" examples from "<<models.size()<<" models";
-}
+		prepared[i] = prepareModel(model, sizePerModel, threadedSearch);
+	}, threadedSearch ? 1 : 0);
 
-EisGeneratorDataset::ModelData* EisGeneratorDataset::findSameClass(std::string modelStr)
-{
-	for(ModelData& model :models)
-	{
-		if(model.model->getModelStr() == modelStr)
-			return &model;
-	}
-	return nullptr;
+	prepared.erase(std::remove_if(prepared.begin(), prepared.end(),
+		[](const ModelData& modelData){return !modelData.model;}), prepared.end());
+	insertModels(prepared);
+	Log(Log::INFO)<<__func__<<" dataset now has "<<size()<<" examples from "<<table->models.size()<<" models";
 }
 
 void EisGeneratorDataset::addModel(const eis::Model& model, size_t targetSize)
@@ -128,12 +171,25 @@ void EisGeneratorDataset::addModel(const eis::Model& model, size_t targetSize)
 
 void EisGeneratorDataset::addModel(std::shared_ptr<eis::Model> model, size_t targetSize)
 {
+	std::vector<ModelData> prepared = {prepareModel(model, targetSize, true)};
+	insertModels(prepared);
+}
+
+EisGeneratorDataset::ModelData EisGeneratorDataset::prepareModel(std::shared_ptr<eis::Model> model, size_t targetSize, bool threaded) const
+{
+	// eis::Model::compile is not documented as thread safe, so models are compiled one at a time
+	// even when they are prepared in parallel
+	static std::mutex compileMutex;
+
 	ModelData modelData;
 	modelData.model = model;
+	modelData.modelStr = model->getModelStr();
 
 	Log(Log::INFO)<<__func__<<" adding model "<<model->getModelStr();
 
 	size_t steps = model->getRequiredStepsForSweeps();
+	if(sweepStore)
+		modelData.storeKey = sweepModelKey(*model, steps);
 
 	if(!grid)
 	{
@@ -144,8 +200,22 @@ void EisGeneratorDataset::addModel(std::shared_ptr<eis::Model> model, size_t tar
 		}
 		else
 		{
-			model->compile();
-			modelData.indecies = model->getRecommendedParamIndices(omega, 0.01, true);
+			{
+				std::scoped_lock lock(compileMutex);
+				model->compile();
+			}
+			constexpr double threshold = 0.01;
+			std::string key = paramCacheKey(*model, steps, omega, threshold);
+			if(useParamCache && paramcache::load(key, modelData.indecies))
+			{
+				Log(Log::DEBUG)<<__func__<<" loaded interesting spectra for "<<model->getModelStr()<<" from cache";
+			}
+			else
+			{
+				modelData.indecies = model->getRecommendedParamIndices(omega, threshold, threaded);
+				if(useParamCache)
+					paramcache::store(key, modelData.indecies);
+			}
 		}
 		modelData.totalCount = targetSize;
 
@@ -165,64 +235,189 @@ void EisGeneratorDataset::addModel(std::shared_ptr<eis::Model> model, size_t tar
 		modelData.totalCount = steps;
 	}
 
-	ModelData* candidate = findSameClass(model->getModelStr());
-	if(candidate)
-	{
-		modelData.classNum = candidate->classNum;
-	}
-	else
-	{
-		modelData.classNum = classCounter;
-		++classCounter;
-	}
-
-	models.push_back(modelData);
+	return modelData;
 }
 
-std::pair<size_t, size_t> EisGeneratorDataset::getModelAndOffsetForIndex(size_t index) const
+void EisGeneratorDataset::insertModels(std::vector<ModelData>& modelData)
 {
-	size_t model = 0;
-	for(; model < models.size(); ++model)
+	// The current table may be in use by other copies, so the models are added to a copy of it
+	std::shared_ptr<ModelTable> writable = std::make_shared<ModelTable>(*table);
+	for(ModelData& model : modelData)
 	{
-		if(index < models[model].totalCount)
-			break;
+		auto search = writable->classForModelStr.find(model.modelStr);
+		if(search != writable->classForModelStr.end())
+		{
+			model.classNum = search->second;
+		}
 		else
-			index -= models[model].totalCount;
+		{
+			model.classNum = writable->classCounter;
+			writable->classForModelStr.insert({model.modelStr, writable->classCounter});
+			++writable->classCounter;
+		}
+
+		size_t oldSize = writable->cumulativeCounts.empty() ? 0 : writable->cumulativeCounts.back();
+		writable->cumulativeCounts.push_back(oldSize + model.totalCount);
+		writable->models.push_back(std::move(model));
 	}
+	table = writable;
+}
+
+std::pair<size_t, size_t> EisGeneratorDataset::getModelAndOffsetForIndex(size_t index) const
+{
+	// Spare candidates reuse the sweeps from the start of the dataset, with their own noise
+	assert(size() > 0);
+	index %= size();
+
+	// The first model whose cumulative count exceeds index contains it
+	const std::vector<size_t>& cumulativeCounts = table->cumulativeCounts;
+	size_t model = std::upper_bound(cumulativeCounts.begin(), cumulativeCounts.end(), index) - cumulativeCounts.begin();
+	if(model > 0)
+		index -= cumulativeCounts[model-1];
 
 	return std::pair<size_t, size_t>(model, index);
 }
 
-eis::Spectra EisGeneratorDataset::getImpl(size_t index)
+eis::Model& EisGeneratorDataset::modelInstance(size_t modelIndex)
 {
-	assert(index < size());
+	std::vector<std::unique_ptr<eis::Model>>& models = instances.models;
+	if(models.size() <= modelIndex)
+		models.resize(table->models.size());
+	if(!models[modelIndex])
+		models[modelIndex] = std::make_unique<eis::Model>(*table->models[modelIndex].model);
+	return *models[modelIndex];
+}
 
-	std::pair<size_t, size_t> modelAndOffset = getModelAndOffsetForIndex(index);
-	ModelData& model = models[modelAndOffset.first];
-	size_t modelIndex = modelAndOffset.second % model.indecies.size();
+const EisGeneratorDataset::CleanSweep& EisGeneratorDataset::getCleanSweep(size_t modelIndex, size_t paramIndex)
+{
+	++sweepCacheTick;
+	for(CleanSweep& sweep : sweepCache)
+	{
+		if(sweep.modelIndex == modelIndex && sweep.paramIndex == paramIndex)
+		{
+			sweep.lastUse = sweepCacheTick;
+			++sweepCacheHits;
+			return sweep;
+		}
+	}
+	++sweepCacheMisses;
+
+	CleanSweep* sweep;
+	if(sweepCache.size() < SWEEP_CACHE_SIZE)
+	{
+		sweepCache.emplace_back();
+		sweep = &sweepCache.back();
+	}
+	else
+	{
+		sweep = &*std::min_element(sweepCache.begin(), sweepCache.end(),
+			[](const CleanSweep& a, const CleanSweep& b){return a.lastUse < b.lastUse;});
+	}
+
+	sweep->modelIndex = modelIndex;
+	sweep->paramIndex = paramIndex;
+	sweep->lastUse = sweepCacheTick;
 
-	std::vector<eis::DataPoint> data = model.model->executeSweep(omega, model.indecies[modelIndex]);
-	assert(data.size());
+	std::string storeKey;
+	SweepStore::Sweep stored;
+	if(sweepStore)
+	{
+		storeKey = SweepStore::makeKey("gen", table->models[modelIndex].storeKey, paramIndex, omega, normalize);
+		if(sweepStore->find(storeKey, stored))
+		{
+			sweep->data = std::move(stored.data);
+			sweep->modelStr = std::move(stored.modelStr);
+			return *sweep;
+		}
+	}
 
+	eis::Model& model = modelInstance(modelIndex);
+	sweep->data = model.executeSweep(omega, paramIndex);
+	assert(sweep->data.size());
 	if(normalize)
-		eis::normalize(data);
+		eis::normalize(sweep->data);
+	sweep->modelStr = model.getModelStrWithParam(paramIndex);
+
+	if(sweepStore)
+	{
+		stored.data = sweep->data;
+		stored.modelStr = sweep->modelStr;
+		sweepStore->add(storeKey, stored);
+	}
+	return *sweep;
+}
+
+const EisGeneratorDataset::CleanSweep* EisGeneratorDataset::generateData(size_t index, size_t modelIndex, size_t offset, std::vector<eis::DataPoint>& data)
+{
+	// Consecutive offsets share a parameter index, so the noisy variants of a clean sweep
+	// are produced in a row and the sweep is only evaluated once
+	const ModelData& model = table->models[modelIndex];
+	size_t paramIndex = offset*model.indecies.size()/model.totalCount;
+	const CleanSweep& sweep = getCleanSweep(modelIndex, model.indecies[paramIndex]);
+
+	data = sweep.data;
 	if(useEisNoise)
 		noise.add(data);
-	eis::noise(data, 0.001, false);
+	rd::Generator generator(index, rd::STREAM_NOISE, streamVariant);
+	addWhiteNoise(data, 0.001, generator);
 
 	if(data.size() != omega.count)
 	{
 		if constexpr(PRINT)
 			std::cout<<__func__<<' '<<index<<" rejected as uninteresting\n";
-		if(index+1 < size())
-			return get(index+1);
-		else
-			return get(0);
+		return nullptr;
 	}
 
-	eis::Spectra spectra(data, model.model->getModelStrWithParam(model.indecies[modelIndex]), typeid(this).name());
+	return &sweep;
+}
+
+eis::Spectra EisGeneratorDataset::generate(size_t index, size_t modelIndex, size_t offset)
+{
+	std::vector<eis::DataPoint> data;
+	const CleanSweep* sweep = generateData(index, modelIndex, offset, data);
+	if(!sweep)
+		return eis::Spectra();
+	return eis::Spectra(data, sweep->modelStr, typeid(this).name());
+}
+
+eis::Spectra EisGeneratorDataset::getImpl(size_t index)
+{
+	assert(index < candidateCount());
+	if(size() == 0)
+		return eis::Spectra();
 
-	return spectra;
+	std::pair<size_t, size_t> modelAndOffset = getModelAndOffsetForIndex(index);
+	return generate(index, modelAndOffset.first, modelAndOffset.second);
+}
+
+void EisGeneratorDataset::getBatch(size_t begin, size_t end, SpectraBatch& batch)
+{
+	batch.clear();
+	if(begin >= end)
+		return;
+	assert(end <= candidateCount());
+
+	// The model is resolved once per batch, consecutive indices then walk through
+	// a model before moveing on to the next one
+	// The noisy data of every sample goes straight from data into the arrays of the batch,
+	// data keeps its storage from sample to sample
+	const std::vector<ModelData>& models = table->models;
+	std::vector<eis::DataPoint> data;
+	auto [model, offset] = getModelAndOffsetForIndex(begin);
+	for(size_t i = begin; i < end; ++i, ++offset)
+	{
+		while(offset >= models[model].totalCount)
+		{
+			offset -= models[model].totalCount;
+			model = (model + 1) % models.size();
+		}
+
+		const CleanSweep* sweep = generateData(i, model, offset, data);
+		if(sweep)
+			batch.append(i, data, eis::Spectra(std::vector<eis::DataPoint>(), sweep->modelStr, typeid(this).name()));
+		else
+			batch.append(i, eis::Spectra());
+	}
 }
 
 size_t EisGeneratorDataset::frequencies()
@@ -232,16 +427,20 @@ size_t EisGeneratorDataset::frequencies()
 
 size_t EisGeneratorDataset::size() const
 {
-	size_t size = 0;
-	for(size_t i = 0; i < models.size(); ++i)
-		size += models[i].totalCount;
-	return size;
+	return table->cumulativeCounts.empty() ? 0 : table->cumulativeCounts.back();
+}
+
+size_t EisGeneratorDataset::candidateCount() const
+{
+	return size() + size()*SPARE_CANDIDATE_PERCENT/100;
 }
 
 size_t EisGeneratorDataset::classForIndex(size_t index)
 {
+	if(size() == 0)
+		return 0;
 	std::pair<size_t, size_t> modelAndOffset = getModelAndOffsetForIndex(index);
-	return models[modelAndOffset.first].classNum;
+	return table->models[modelAndOffset.first].classNum;
 }
 
 EisGeneratorDataset* EisGeneratorDataset::getTestDataset()
@@ -251,10 +450,10 @@ EisGeneratorDataset* EisGeneratorDataset::getTestDataset()
 
 std::string EisGeneratorDataset::modelStringForClass(size_t classNum)
 {
-	for(ModelData model : models)
+	for(const ModelData& model : table->models)
 	{
 		if(model.classNum == classNum)
-			return model.model->getModelStr();
+			return model.modelStr;
 	}
 	return "invalid";
 }
@@ -262,6 +461,18 @@ std::string EisGeneratorDataset::modelStringForClass(size_t classNum)
 void EisGeneratorDataset::setOmegaRange(eis::Range range)
 {
 	omega = range;
+	sweepCache.clear();
+}
+
+std::string EisGeneratorDataset::getStatistics()
+{
+	size_t lookups = sweepCacheHits + sweepCacheMisses;
+	if(lookups == 0)
+		return "";
+
+	std::stringstream ss;
+	ss<<"sweep cache hit rate "<<(sweepCacheHits*100.0)/lookups<<"% of "<<lookups;
+	return ss.str();
 }
 
 std::string EisGeneratorDataset::getOptionsHelp()
@@ -271,15 +482,17 @@ std::string EisGeneratorDataset::getOptionsHelp()
 	ss<<"no-normalization: dont normalize the data\n";
 	ss<<"no-noise:         dont use libeisnoise to add noise\n";
 	ss<<"grid:             use a parameter grid instead of the eis::model::getRecommendedParamIndices heuristic\n";
+	ss<<"no-cache:         dont use the on disk cache of eis::model::getRecommendedParamIndices results\n";
+	ss<<"sweep-store:      keep noise free spectra in an on disk store and reuse them in later runs\n";
 	return ss.str();
 }
 
 std::vector<std::string> EisGeneratorDataset::getOptions()
 {
-	return {"size", "no-normalization", "no-noise", "grid"};
+	return {"size", "no-normalization", "no-noise", "grid", "no-cache", "sweep-store"};
 }
 
 std::vector<int> EisGeneratorDataset::getDefaultOptionValues()
 {
-	return{1000, 0, 0, 0};
+	return{1000, 0, 0, 0, 0, 0};
 }
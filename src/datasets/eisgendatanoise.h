@@ -23,45 +23,104 @@
 #include <cstddef>
 #include <vector>
 #include <string>
+#include <unordered_map>
 #include <filesystem>
 #include <memory>
 #include <eisgenerator/model.h>
 #include <eisnoise/eisnoise.h>
 
 #include "eisdataset.h"
+#include "../sweepstore.h"
 
 class EisGeneratorDataset :
 public EisDataset
 {
 	struct ModelData
 	{
-		std::shared_ptr<eis::Model> model;
+		// Never evaluated, every copy of the dataset clones its own instance from it
+		std::shared_ptr<const eis::Model> model;
+		std::string modelStr;
 		std::vector<size_t> indecies;
 		size_t totalCount;
 		size_t classNum;
+		// Identifies the model in the sweep store
+		std::string storeKey;
+	};
+
+	// A sweep before any noise is added, it is shared by every example of its parameter index
+	struct CleanSweep
+	{
+		size_t modelIndex = 0;
+		size_t paramIndex = 0;
+		std::vector<eis::DataPoint> data;
+		std::string modelStr;
+		size_t lastUse = 0;
 	};
 
 public:
 	static constexpr bool PRINT = false;
 	static constexpr size_t DEFAULT_EXAMPLE_COUNT = 1e8;
+	static constexpr size_t SWEEP_CACHE_SIZE = 16;
+	static constexpr size_t SPARE_CANDIDATE_PERCENT = 10;
 
 private:
-	std::vector<ModelData> models;
+	// The models and their parameter indices are shared between all copies of the dataset
+	// and are never modified once shared, adding models replaces the table of this copy
+	struct ModelTable
+	{
+		std::vector<ModelData> models;
+		// cumulativeCounts[i] is the sum of totalCount over models 0 to i
+		std::vector<size_t> cumulativeCounts;
+		size_t classCounter = 0;
+		std::unordered_map<std::string, size_t> classForModelStr;
+	};
+	std::shared_ptr<const ModelTable> table = std::make_shared<const ModelTable>();
+
+	// eis::Model is not safe to evaluate from several threads, so every copy of the dataset
+	// lazily clones the models it evaluates. Copies start out without any instances.
+	struct ModelInstances
+	{
+		std::vector<std::unique_ptr<eis::Model>> models;
+
+		ModelInstances() = default;
+		ModelInstances(const ModelInstances&) {}
+		ModelInstances& operator=(const ModelInstances&)
+		{
+			models.clear();
+			return *this;
+		}
+	};
+	ModelInstances instances;
 
 	eis::Range omega;
 	EisNoise noise;
 	bool useEisNoise = true;
+	uint64_t streamVariant = 0;
 	bool normalize = true;
 	bool grid = false;
+	bool useParamCache = true;
+	std::shared_ptr<SweepStore> sweepStore;
 	int desiredSize;
-	size_t classCounter = 0;
+
+	// Least recently used clean sweeps, every copy of the dataset has its own
+	std::vector<CleanSweep> sweepCache;
+	size_t sweepCacheTick = 0;
+	size_t sweepCacheHits = 0;
+	size_t sweepCacheMisses = 0;
 
 private:
 	std::pair<size_t, size_t> getModelAndOffsetForIndex(size_t index) const;
 	void addVectorOfModels(const std::vector<std::string>& modelStrs);
 
 	virtual eis::Spectra getImpl(size_t index) override;
-	ModelData* findSameClass(std::string modelStr);
+	eis::Spectra generate(size_t index, size_t modelIndex, size_t offset);
+	// Writes the noisy data of a sample into data, returns the clean sweep it is based on or nullptr if the sample is rejected
+	const CleanSweep* generateData(size_t index, size_t modelIndex, size_t offset, std::vector<eis::DataPoint>& data);
+	const CleanSweep& getCleanSweep(size_t modelIndex, size_t paramIndex);
+	eis::Model& modelInstance(size_t modelIndex);
+	// If threaded is set the parameter search uses all cores, it must not be set when called from several threads at once
+	ModelData prepareModel(std::shared_ptr<eis::Model> model, size_t targetExamples, bool threaded) const;
+	void insertModels(std::vector<ModelData>& modelData);
 
 public:
 	explicit EisGeneratorDataset(const std::vector<int>& options, int64_t outputSize);
@@ -82,4 +141,9 @@ public:
 	virtual size_t classForIndex(size_t index) override;
 	virtual std::string modelStringForClass(size_t classNum) override;
 	virtual size_t size() const override;
+	virtual EisDataset* clone() const override {return new EisGeneratorDataset(*this);}
+	virtual size_t candidateCount() const override;
+	virtual void setStreamVariant(uint64_t variant) override {streamVariant = variant;}
+	virtual std::string getStatistics() override;
+	virtual void getBatch(size_t begin, size_t end, SpectraBatch& batch) override;
 };
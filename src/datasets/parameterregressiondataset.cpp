@@ -22,11 +22,14 @@
 #include <eisdrt/eisdrt.h>
 #include <eisdrt/types.h>
 #include <complex>
+#include <cmath>
+#include <sstream>
 #include <kisstype/type.h>
 #include <eisgenerator/basicmath.h>
 
 #include "parameterregressiondataset.h"
 #include "../log.h"
+#include "../drtscreen.h"
 
 ParameterRegressionDataset::ParameterRegressionDataset(const std::vector<int>& options, const std::string& modelStr, int64_t outputSize):
 model(modelStr)
@@ -35,44 +38,97 @@ model(modelStr)
 
 	int desiredSize =  options[0];
 	drt = options[1];
+	prescreen = options[3];
 
 	omega = eis::Range(1, 10e6, drt ? outputSize : outputSize/2, true);
+	if(drt)
+		omegas = omega.getRangeVector();
+	oversample = drt ? DRT_OVERSAMPLE : 1;
 	model.compile();
 	sweepCount = model.getRequiredStepsForSweeps();
-	model.setParamSweepCountClosestTotal(desiredSize);
+	model.setParamSweepCountClosestTotal(desiredSize*oversample);
 	sweepCount = model.getRequiredStepsForSweeps();
 	parameterCount = model.getParameterCount();
+
+	if(options[2])
+	{
+		sweepStore = SweepStore::openDefault();
+		std::stringstream ss;
+		ss<<model.getModelStr()<<'\n'<<model.getModelStrWithParam(0)<<'\n'<<model.getModelStrWithParam(sweepCount-1)<<'\n'<<sweepCount;
+		storeKey = ss.str();
+		labelNames = model.getParameterNames();
+	}
+}
+
+// The first size() candidates take every oversample-th sweep so that they span the whole
+// parameter space, the spare candidates then fill in the sweeps in between.
+// Consecutive candidates are thus oversample sweep steps apart, not neighbouring steps.
+size_t ParameterRegressionDataset::sweepIndexForCandidate(size_t index) const
+{
+	return (index % size())*oversample + index/size();
 }
 
 eis::Spectra ParameterRegressionDataset::getImpl(size_t index)
 {
-	std::vector<eis::DataPoint> data = model.executeSweep(omega, index);
+	assert(index < candidateCount());
+	index = sweepIndexForCandidate(index);
+
+	std::vector<eis::DataPoint> data;
+	std::string modelStr;
+	std::vector<fvalue> labels;
+	std::string key;
+	SweepStore::Sweep stored;
+	if(sweepStore)
+		key = SweepStore::makeKey("regression", storeKey, index, omega, false, labelNames);
+
+	if(sweepStore && sweepStore->find(key, stored))
+	{
+		data = std::move(stored.data);
+		modelStr = std::move(stored.modelStr);
+		labels = std::move(stored.labels);
+	}
+	else
+	{
+		data = model.executeSweep(omega, index);
+		modelStr = model.getModelStrWithParam();
+		labels = model.getFlatParameters();
+		if(sweepStore)
+			sweepStore->add(key, {data, modelStr, labels});
+	}
 
 	assert(data.size());
+	if(drt && prescreen && !screenCandidate(data))
+		return eis::Spectra();
+
 	if(drt)
 	{
 		FitMetrics fm;
 		try {
 			fvalue rSeries;
-			std::vector<fvalue> drt = calcDrt(data, fm, FitParameters(1000), &rSeries);
-			std::vector<fvalue> omegas = omega.getRangeVector();
+			// Every fit starts cold, calcDrt takes no initial solution to warm start from
+			std::vector<fvalue> drt = calcDrt(data, fm, fitParameters, &rSeries);
+			++drtStatistics.fits;
+			drtStatistics.iterations += fm.iterations;
 			assert(drt.size() == omegas.size());
 
 			if(*drt.begin() > 0.001)
 			{
 				Log(Log::INFO)<<"Drt low side incompleate";
+				++drtStatistics.lowSide;
 				return eis::Spectra();
 			}
 
 			if(drt.back() > 0.001)
 			{
 				Log(Log::INFO)<<"Drt high side incompleate";
+				++drtStatistics.highSide;
 				return eis::Spectra();
 			}
 
 			if(*std::max_element(drt.begin(), drt.end()) < 0.001)
 			{
 				Log(Log::INFO)<<"Drt is empty, discarding";
+				++drtStatistics.empty;
 				return eis::Spectra();
 			}
 
@@ -81,10 +137,11 @@ eis::Spectra ParameterRegressionDataset::getImpl(size_t index)
 			if(dist > 2)
 			{
 				Log(Log::DEBUG)<<"Drt is of poor quality, discarding";
+				++drtStatistics.poorQuality;
 				return eis::Spectra();
 			}
 
-			data.assign(drt.size(), eis::DataPoint());
+			data.resize(drt.size());
 			for(size_t i = 0; i < drt.size(); ++i)
 			{
 				data[i].im = std::complex<fvalue>(drt[i], 0);
@@ -94,23 +151,26 @@ eis::Spectra ParameterRegressionDataset::getImpl(size_t index)
 		catch (const drt_error& ex)
 		{
 			Log(Log::DEBUG)<<"Drt calculation failed!";
-			index++;
-			if(index >= size())
-				index = 0;
+			++drtStatistics.failed;
 			return eis::Spectra();
 		}
 	}
 
-	eis::Spectra spectra(data, model.getModelStrWithParam(), typeid(this).name());
+	eis::Spectra spectra(data, modelStr, typeid(this).name());
 
 	spectra.labelNames = model.getParameterNames();
-	spectra.setLabels(model.getFlatParameters());
+	spectra.setLabels(labels);
 	return spectra;
 }
 
 size_t ParameterRegressionDataset::size() const
 {
-	return sweepCount;
+	return sweepCount/oversample;
+}
+
+size_t ParameterRegressionDataset::candidateCount() const
+{
+	return size()*oversample;
 }
 
 size_t ParameterRegressionDataset::classForIndex(size_t index)
@@ -122,6 +182,8 @@ size_t ParameterRegressionDataset::classForIndex(size_t index)
 void ParameterRegressionDataset::setOmegaRange(eis::Range range)
 {
 	omega = range;
+	if(drt)
+		omegas = omega.getRangeVector();
 }
 
 std::string ParameterRegressionDataset::modelStringForClass(size_t classNum)
@@ -146,20 +208,67 @@ std::string ParameterRegressionDataset::modelStringForClass(size_t classNum)
 	return model.getModelStr();
 }
 
+// Runs the drt prescreen and counts what it rejected. A spectrum whose arc is still open
+// at an edge, -Im(Z) still rising toward the edge while Re(Z) still changes, yields a drt
+// that is cut off on that side, one with negligible phase everywhere yields an empty drt.
+bool ParameterRegressionDataset::screenCandidate(const std::vector<eis::DataPoint>& data)
+{
+	switch(screenDrtCandidate(data))
+	{
+		case DRT_SCREEN_LOW_SIDE:
+			++drtStatistics.screenedLowSide;
+			return false;
+		case DRT_SCREEN_HIGH_SIDE:
+			++drtStatistics.screenedHighSide;
+			return false;
+		case DRT_SCREEN_EMPTY:
+			++drtStatistics.screenedEmpty;
+			return false;
+		case DRT_SCREEN_PASS:
+		default:
+			return true;
+	}
+}
+
+std::string ParameterRegressionDataset::getStatistics()
+{
+	size_t screened = drtStatistics.screenedLowSide + drtStatistics.screenedHighSide + drtStatistics.screenedEmpty;
+	if(drtStatistics.fits == 0 && drtStatistics.failed == 0 && screened == 0)
+		return "";
+
+	std::stringstream ss;
+	ss<<"drt fits "<<drtStatistics.fits<<" with a mean of "
+		<<(drtStatistics.fits > 0 ? drtStatistics.iterations/static_cast<double>(drtStatistics.fits) : 0.0)
+		<<" iterations, "<<drtStatistics.failed<<" failed, rejected: "
+		<<drtStatistics.lowSide<<" low side "
+		<<drtStatistics.highSide<<" high side "
+		<<drtStatistics.empty<<" empty "
+		<<drtStatistics.poorQuality<<" poor quality";
+	if(prescreen)
+	{
+		ss<<", screened: "<<drtStatistics.screenedLowSide<<" low side "
+			<<drtStatistics.screenedHighSide<<" high side "
+			<<drtStatistics.screenedEmpty<<" empty";
+	}
+	return ss.str();
+}
+
 std::string ParameterRegressionDataset::getOptionsHelp()
 {
 	std::stringstream ss;
 	ss<<"size: the size the dataset should have\n";
 	ss<<"drt:  if set the spectra will be converted into a drt\n";
+	ss<<"sweep-store: keep the simulated spectra in an on disk store and reuse them in later runs\n";
+	ss<<"prescreen: with drt, skip spectra whose drt would be cut off or empty without fitting them\n";
 	return ss.str();
 }
 
 std::vector<std::string> ParameterRegressionDataset::getOptions()
 {
-	return {"size", "drt"};
+	return {"size", "drt", "sweep-store", "prescreen"};
 }
 
 std::vector<int> ParameterRegressionDataset::getDefaultOptionValues()
 {
-	return {10000, false};
+	return {10000, false, false, false};
 }
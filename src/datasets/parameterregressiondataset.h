@@ -21,26 +21,56 @@
 
 #include <kisstype/type.h>
 #include <eisgenerator/model.h>
+#include <eisdrt/types.h>
 #include <string>
+#include <memory>
 
 #include "eisdataset.h"
+#include "../sweepstore.h"
 
 class ParameterRegressionDataset: public EisDataset
 {
 public:
 	static constexpr size_t DEFAULT_EXAMPLE_COUNT = 1e8;
+	// With drt this many sweeps are available per example to replace rejected ones
+	static constexpr size_t DRT_OVERSAMPLE = 2;
 
 private:
 	eis::Model model;
 
 	eis::Range omega;
 	size_t sweepCount;
+	size_t oversample;
 	size_t parameterCount;
 	bool drt;
+	bool prescreen;
+	// The frequencies of omega, only needed for drt
+	std::vector<fvalue> omegas;
+	FitParameters fitParameters = FitParameters(1000);
+
+	struct DrtStatistics
+	{
+		size_t fits = 0;
+		size_t iterations = 0;
+		size_t failed = 0;
+		size_t lowSide = 0;
+		size_t highSide = 0;
+		size_t empty = 0;
+		size_t poorQuality = 0;
+		size_t screenedLowSide = 0;
+		size_t screenedHighSide = 0;
+		size_t screenedEmpty = 0;
+	};
+	DrtStatistics drtStatistics;
+	std::shared_ptr<SweepStore> sweepStore;
+	std::string storeKey;
+	// The labels stored with every sweep, part of the sweep store key
+	std::vector<std::string> labelNames;
 
 private:
 	virtual eis::Spectra getImpl(size_t index) override;
-	static fvalue max(const std::vector<eis::DataPoint>& data);
+	size_t sweepIndexForCandidate(size_t index) const;
+	bool screenCandidate(const std::vector<eis::DataPoint>& data);
 
 public:
 	explicit ParameterRegressionDataset(const std::vector<int>& options, const std::string& model, int64_t outputSize = 100);
@@ -51,6 +81,9 @@ public:
 	virtual size_t classForIndex(size_t index) override;
 	virtual std::string modelStringForClass(size_t classNum) override;
 	virtual size_t size() const override;
+	virtual EisDataset* clone() const override {return new ParameterRegressionDataset(*this);}
+	virtual size_t candidateCount() const override;
+	virtual std::string getStatistics() override;
 
 	static std::string getOptionsHelp();
 	static std::vector<std::string> getOptions();
@@ -23,7 +23,6 @@
 #include <vector>
 #include <kisstype/type.h>
 #include <spectra.h>
-#include <mutex>
 #include <memory>
 
 #include "eisdataset.h"
@@ -32,8 +31,8 @@
 class PassFaillDataset:
 public EisDataset
 {
-	EisDataset* dataset_;
-	std::shared_ptr<std::mutex> datasetMutex_;
+	// Every copy owns its own copy of the inner dataset, so copies can generate in parallel
+	std::unique_ptr<EisDataset> dataset_;
 
 private:
 	void normalize(std::vector<eis::DataPoint> data)
@@ -43,32 +42,36 @@ private:
 			dp = dp / max;
 	}
 
-	void randomize(std::vector<eis::DataPoint>& data, double magnitude)
+	void randomize(std::vector<eis::DataPoint>& data, double magnitude, rd::Generator& generator)
 	{
 		for(size_t i = 1; i < data.size()-1; ++i)
-			data[i].im += std::complex<fvalue>((rd::rand(2)-1)*magnitude, (rd::rand(2)-1)*magnitude);
+			data[i].im += std::complex<fvalue>((generator.rand(2)-1)*magnitude, (generator.rand(2)-1)*magnitude);
 		normalize(data);
 	}
 
 	virtual eis::Spectra getImpl(size_t index) override
 	{
-		datasetMutex_->lock();
+		// Both halves use the same inner samples, the pass half draws its noise from other
+		// streams so that a pass sample does not carry the noise of its fail counterpart
+		dataset_->setStreamVariant(index < dataset_->size() ? 0 : 1);
 		eis::Spectra example = dataset_->get(index % dataset_->size());
-		datasetMutex_->unlock();
+		if(example.data.empty())
+			return example;
 		bool pass = true;
 		if(index < dataset_->size())
 		{
 			pass = false;
-			if(rd::rand() < 0.01)
+			rd::Generator generator(index, rd::STREAM_PERTURBATION);
+			if(generator.rand() < 0.01)
 			{
 				for(eis::DataPoint& dp : example.data)
-					dp.im = std::complex<fvalue>(rd::rand(), rd::rand());
+					dp.im = std::complex<fvalue>(generator.rand(), generator.rand());
 				normalize(example.data);
 			}
 			else
 			{
-				double magnitude = rd::rand(0.02)+0.01;
-				randomize(example.data, magnitude);
+				double magnitude = generator.rand(0.02)+0.01;
+				randomize(example.data, magnitude, generator);
 			}
 		}
 
@@ -80,10 +83,19 @@ private:
 	}
 
 public:
-	PassFaillDataset(EisDataset *dataset):
-	dataset_(dataset)
+	PassFaillDataset(const EisDataset *dataset):
+	dataset_(dataset->clone())
 	{
-		datasetMutex_.reset(new std::mutex);
+	}
+
+	PassFaillDataset(const PassFaillDataset& in):
+	dataset_(in.dataset_->clone())
+	{
+	}
+
+	virtual EisDataset* clone() const override
+	{
+		return new PassFaillDataset(*this);
 	}
 
 	virtual size_t size() const override
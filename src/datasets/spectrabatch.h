@@ -0,0 +1,115 @@
+/* * KissDatasetGenerator - A generator of datasets for TorchKissAnn
+ * Copyright (C) 2025 Carl Klemm <carl@uvos.xyz>
+ *
+ * This file is part of KissDatasetGenerator.
+ *
+ * KissDatasetGenerator is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * KissDatasetGenerator is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with KissDatasetGenerator.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+#include <cstddef>
+#include <vector>
+#include <kisstype/spectra.h>
+
+/*
+ * A batch of spectra stored as structure of arrays. The frequency, real and imaginary
+ * values of all samples are kept in three contiguous arrays laid out as
+ * [sample][frequency], the remaining fields of every sample are kept in a spectrum
+ * whose data is left empty. Clearing a batch keeps its storage so that a batch
+ * reused for many chunks stops allocateing once it has grown to the chunk size.
+ */
+class SpectraBatch
+{
+	std::vector<size_t> indices;
+	std::vector<size_t> offsets = {0};
+	std::vector<fvalue> omegas;
+	std::vector<fvalue> reals;
+	std::vector<fvalue> imags;
+	std::vector<eis::Spectra> metas;
+
+public:
+	void clear()
+	{
+		indices.clear();
+		offsets.assign(1, 0);
+		omegas.clear();
+		reals.clear();
+		imags.clear();
+		metas.clear();
+	}
+
+	// Adds the sample with dataset index index, its data points are written straight into the
+	// arrays and meta holds the remaining fields
+	void append(size_t index, const std::vector<eis::DataPoint>& data, eis::Spectra&& meta)
+	{
+		for(const eis::DataPoint& point : data)
+		{
+			omegas.push_back(point.omega);
+			reals.push_back(point.im.real());
+			imags.push_back(point.im.imag());
+		}
+		offsets.push_back(omegas.size());
+		indices.push_back(index);
+		meta.data.clear();
+		metas.push_back(std::move(meta));
+	}
+
+	// Adds the sample with dataset index index, the data of spectra is moved into the arrays
+	void append(size_t index, eis::Spectra&& spectra)
+	{
+		std::vector<eis::DataPoint> data = std::move(spectra.data);
+		append(index, data, std::move(spectra));
+	}
+
+	size_t size() const
+	{
+		return indices.size();
+	}
+
+	size_t index(size_t sample) const
+	{
+		return indices[sample];
+	}
+
+	size_t frequencies(size_t sample) const
+	{
+		return offsets[sample+1] - offsets[sample];
+	}
+
+	const fvalue* omega(size_t sample) const
+	{
+		return omegas.data() + offsets[sample];
+	}
+
+	const fvalue* real(size_t sample) const
+	{
+		return reals.data() + offsets[sample];
+	}
+
+	const fvalue* imag(size_t sample) const
+	{
+		return imags.data() + offsets[sample];
+	}
+
+	// Model, header and labels of a sample, its data is empty
+	eis::Spectra& meta(size_t sample)
+	{
+		return metas[sample];
+	}
+
+	const eis::Spectra& meta(size_t sample) const
+	{
+		return metas[sample];
+	}
+};
@@ -21,12 +21,17 @@
 #include "tarloader.h"
 
 #include <algorithm>
+#include <limits>
 #include <assert.h>
 #include <kisstype/type.h>
 #include <eisgenerator/translators.h>
 
 #include "model.h"
 #include "../log.h"
+#include "../tarindex.h"
+#include "../microtar.h"
+#include "../spectraparser.h"
+#include "../parallelfor.h"
 
 #include "filterdata.h"
 
@@ -37,129 +42,177 @@ inputSize(inputSize), selectLabels(selectLabels), extraInputs(extraInputs),path(
 
 	normalization = options[0];
 
-	int ret = mtar_open(&tar, path.c_str(), "r");
-	if(ret)
+	map = std::make_shared<const MappedFile>(path);
+	if(!map->isOpen())
 	{
 		Log(Log::ERROR)<<"Unable to open tar at "<<path;
 		return;
 	}
 
-	mtar_header_t header;
-	while((mtar_read_header(&tar, &header)) != MTAR_ENULLRECORD)
-	{
-		if(header.type == MTAR_TREG)
-		{
-			std::filesystem::path path = header.name;
-			size_t pos = tar.pos;
-			eis::Spectra spectra = loadSpectraAtCurrentPos(header.size);
+	if(!loadIndex())
+		scan();
 
-			bool skip = false;
-			for(const std::string& key : selectLabels)
-			{
-				if(!spectra.hasLabel(key))
-				{
-					Log(Log::INFO)<<"Dsicarding as it is missing: "<<key;
-					skip = true;
-					break;
-				}
-			}
-			for(const std::string& key : extraInputs)
-			{
-				if(!spectra.hasLabel(key))
-				{
-					Log(Log::INFO)<<"Dsicarding as it is missing: "<<key;
-					skip = true;
-					break;
-				}
-				continue;
-			}
+	if(table->files.size() < 20)
+		Log(Log::WARN)<<"found few valid files in "<<path;
+}
+
+static std::string normalizeModel(std::string model)
+{
+	eis::purgeEisParamBrackets(model);
+	eis::Model::removeSeriesResitance(model);
+
+	if(model.length() < 2 && model != "r" && model != "c" && model != "w" && model != "p" && model != "l")
+		model = "Union";
+	return model;
+}
 
-			if(!skip)
+TarDataset::FileTable& TarDataset::fileTable()
+{
+	if(table.use_count() > 1)
+		table = std::make_shared<FileTable>(*table);
+	return *table;
+}
+
+size_t TarDataset::classForModel(const std::string& model)
+{
+	FileTable& files = fileTable();
+	auto search = files.modelIds.find(model);
+	if(search != files.modelIds.end())
+		return search->second;
+
+	size_t index = files.modelStrs.size();
+	files.modelStrs.push_back(model);
+	files.modelIds.insert({model, index});
+	Log(Log::DEBUG)<<"New model "<<index<<": "<<model;
+	return index;
+}
+
+bool TarDataset::hasRequiredLabels(const std::vector<std::string>& labelNames) const
+{
+	for(const std::vector<std::string>* keys : {&selectLabels, &extraInputs})
+	{
+		for(const std::string& key : *keys)
+		{
+			if(std::find(labelNames.begin(), labelNames.end(), key) == labelNames.end())
 			{
-				eis::purgeEisParamBrackets(spectra.model);
-				eis::Model::removeSeriesResitance(spectra.model);
-
-				if(spectra.model.length() < 2 && spectra.model != "r" && spectra.model != "c" && spectra.model != "w" && spectra.model != "p" && spectra.model != "l")
-					spectra.model = "Union";
-
-				auto search = std::find(modelStrs.begin(), modelStrs.end(), spectra.model);
-				size_t index;
-				if(search == modelStrs.end())
-				{
-					index = modelStrs.size();
-					modelStrs.push_back(spectra.model);
-					Log(Log::DEBUG)<<"New model "<<index<<": "<<spectra.model;
-				}
-				else
-				{
-					index = search - modelStrs.begin();
-				}
-				files.push_back({.path = path, .classNum = index, .pos = pos, .size = header.size});
+				Log(Log::INFO)<<"Dsicarding as it is missing: "<<key;
+				return false;
 			}
 		}
-		mtar_next(&tar);
 	}
-	if(files.size() < 20)
-		Log(Log::WARN)<<"found few valid files in "<<path;
+	return true;
 }
 
-eis::Spectra TarDataset::loadSpectraAtCurrentPos(size_t size)
+bool TarDataset::loadIndex()
 {
-	char* filebuffer = new char[size+1];
-	filebuffer[size] = '\0';
-	int ret = mtar_read_data(&tar, filebuffer, size);
-	if(ret != 0)
-	{
-		Log(Log::ERROR)<<"Unable to read from tar archive";
-		assert(ret == 0);
-	}
-	std::stringstream ss(filebuffer);
+	TarIndex index;
+	if(!index.load(path))
+		return false;
 
-	eis::Spectra spectra = eis::Spectra::loadFromStream(ss);
-	delete[] filebuffer;
+	// Label presence and classes are resolved once per distinct label set and model
+	std::vector<bool> labelSetValid;
+	for(const std::vector<std::string>& labelNames : index.getLabelSets())
+		labelSetValid.push_back(hasRequiredLabels(labelNames));
 
-	return spectra;
-}
+	constexpr size_t UNASSIGNED = std::numeric_limits<size_t>::max();
+	std::vector<size_t> classes(index.getModels().size(), UNASSIGNED);
 
-TarDataset::TarDataset(const TarDataset& in)
-{
-	operator=(in);
+	std::vector<File>& files = fileTable().files;
+	files.reserve(index.getMembers().size());
+	for(const TarIndex::Member& member : index.getMembers())
+	{
+		if(!labelSetValid[member.labelSet])
+			continue;
+
+		// Assign classes in archive order so that they match what a scan would produce
+		if(classes[member.model] == UNASSIGNED)
+			classes[member.model] = classForModel(normalizeModel(index.getModels()[member.model]));
+		files.push_back({.path = member.name, .classNum = classes[member.model], .pos = member.dataOffset, .size = member.size});
+	}
+
+	Log(Log::INFO)<<"Loaded "<<index.getMembers().size()<<" members of "<<path<<" from "<<TarIndex::indexPath(path);
+	return true;
 }
 
-TarDataset& TarDataset::operator=(const TarDataset& in)
+void TarDataset::scan()
 {
-	files = in.files;
-	inputSize = in.inputSize;
-	modelStrs = in.modelStrs;
-	selectLabels = in.selectLabels;
-	extraInputs = in.extraInputs;
-	path = in.path;
-	normalization = in.normalization;
+	mtar_t tar;
 	int ret = mtar_open(&tar, path.c_str(), "r");
-	if(ret != 0)
+	if(ret)
+	{
+		Log(Log::ERROR)<<"Unable to open tar at "<<path;
+		return;
+	}
+
+	std::vector<File> members;
+	mtar_header_t header;
+	while((ret = mtar_read_header(&tar, &header)) == MTAR_ESUCCESS)
+	{
+		if(header.type == MTAR_TREG)
+		{
+			uint64_t pos = tar.pos + tar.header_size;
+			if(pos + header.size > map->size())
+			{
+				ret = MTAR_EREADFAIL;
+				break;
+			}
+			members.push_back({.path = header.name, .classNum = 0, .pos = pos, .size = header.size});
+		}
+		mtar_next(&tar);
+	}
+	if(ret != MTAR_ENULLRECORD)
+		Log(Log::WARN)<<"Stopped reading "<<path<<" early: "<<mtar_strerror(ret);
+	mtar_close(&tar);
+
+	// Only the metadata of each member is parsed, spread over all cores
+	std::vector<std::string> models(members.size());
+	std::vector<char> valid(members.size(), false);
+	parallelFor(members.size(), [&](size_t i)
 	{
-		Log(Log::ERROR)<<"Unable to reopen tar file at "<<path;
-		assert(ret == 0);
+		try
+		{
+			eis::Spectra spectra;
+			if(!parseSpectraHeader(map->data() + members[i].pos, members[i].size, spectra))
+				spectra = loadSpectra(members[i].pos, members[i].size);
+			if(!hasRequiredLabels(spectra.labelNames))
+				return;
+			models[i] = normalizeModel(spectra.model);
+			valid[i] = true;
+		}
+		catch(const eis::file_error& err)
+		{
+			Log(Log::WARN)<<"Can't load "<<members[i].path<<" from "<<path<<' '<<err.what();
+		}
+	});
+
+	// Classes are assigned in archive order
+	std::vector<File>& files = fileTable().files;
+	for(size_t i = 0; i < members.size(); ++i)
+	{
+		if(!valid[i])
+			continue;
+		members[i].classNum = classForModel(models[i]);
+		files.push_back(std::move(members[i]));
 	}
-	return *this;
 }
 
-TarDataset::~TarDataset()
+eis::Spectra TarDataset::loadSpectra(uint64_t pos, uint64_t size) const
 {
-	mtar_close(&tar);
+	// Parse straight from the mapping, no copy of the member is made
+	return parseSpectra(map->data() + pos, size);
 }
 
 eis::Spectra TarDataset::getImpl(size_t index)
 {
-	if(files.size() < index)
+	if(index >= table->files.size())
 	{
 		Log(Log::ERROR)<<"index "<<index<<" out of range in "<<__func__;
 		assert(false);
 		return {};
 	}
 
-	mtar_seek(&tar, files[index].pos);
-	eis::Spectra spectra = loadSpectraAtCurrentPos(files[index].size);
+	const File& file = table->files[index];
+	eis::Spectra spectra = loadSpectra(file.pos, file.size);
 
 	filterData(spectra.data, inputSize, normalization);
 
@@ -179,20 +232,20 @@ eis::Spectra TarDataset::getImpl(size_t index)
 
 size_t TarDataset::classForIndex(size_t index)
 {
-	return files[index].classNum;
+	return table->files[index].classNum;
 }
 
 size_t TarDataset::size() const
 {
-	return files.size();
+	return table->files.size();
 }
 
 std::string TarDataset::modelStringForClass(size_t classNum)
 {
-	if(classNum >= modelStrs.size())
+	if(classNum >= table->modelStrs.size())
 		return "invalid";
 	else
-		return *std::next(modelStrs.begin(), classNum);
+		return table->modelStrs[classNum];
 }
 
 std::string TarDataset::getOptionsHelp()
@@ -20,47 +20,64 @@
 #pragma once
 
 #include <cstdint>
+#include <memory>
+#include <unordered_map>
 #include <vector>
 #include <string>
 #include <filesystem>
 #include <kisstype/spectra.h>
 
 #include "eisdataset.h"
-#include "microtar.h"
+#include "../mappedfile.h"
 
 
 class TarDataset : public EisDataset
 {
 private:
 
-	mtar_t tar;
+	// The archive is mapped once and shared by all copies of the dataset
+	std::shared_ptr<const MappedFile> map;
 
 	struct File
 	{
 		std::filesystem::path path;
 		size_t classNum;
-		size_t pos;
-		size_t size;
+		// offset of the member data in the archive
+		uint64_t pos;
+		uint64_t size;
 	};
 
-	std::vector<TarDataset::File> files;
+	// The member table is shared between all copies of the dataset,
+	// modifying it via fileTable() first makes this copy the sole owner
+	struct FileTable
+	{
+		std::vector<TarDataset::File> files;
+		std::vector<std::string> modelStrs;
+		std::unordered_map<std::string, size_t> modelIds;
+	};
+	std::shared_ptr<FileTable> table = std::make_shared<FileTable>();
+
 	size_t inputSize;
-	std::vector<std::string> modelStrs;
 	std::vector<std::string> selectLabels;
 	std::vector<std::string> extraInputs;
 	std::filesystem::path path;
 	bool normalization;
 
 	virtual eis::Spectra getImpl(size_t index) override;
-	eis::Spectra loadSpectraAtCurrentPos(size_t size);
+	eis::Spectra loadSpectra(uint64_t pos, uint64_t size) const;
+	bool loadIndex();
+	void scan();
+	size_t classForModel(const std::string& model);
+	FileTable& fileTable();
+	bool hasRequiredLabels(const std::vector<std::string>& labelNames) const;
 
 public:
 	explicit TarDataset(const std::vector<int>& options, const std::filesystem::path& path, int64_t inputSize = 100, std::vector<std::string> selectLabels = {}, std::vector<std::string> extraInputs = {});
-	TarDataset(const TarDataset& in);
-	TarDataset& operator=(const TarDataset& in);
-	~TarDataset();
+	TarDataset(const TarDataset& in) = default;
+	TarDataset& operator=(const TarDataset& in) = default;
 
 	virtual size_t size() const override;
+	virtual EisDataset* clone() const override {return new TarDataset(*this);}
 
 	virtual size_t classForIndex(size_t index) override;
 	virtual std::string modelStringForClass(size_t classNum) override;
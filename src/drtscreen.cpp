@@ -0,0 +1,66 @@
+//
+// KissDatasetGenerator - A generator of datasets for TorchKissAnn
+// Copyright (C) 2025 Carl Klemm <carl@uvos.xyz>
+//
+// This file is part of KissDatasetGenerator.
+//
+// KissDatasetGenerator is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// KissDatasetGenerator is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with KissDatasetGenerator.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include "drtscreen.h"
+
+#include <algorithm>
+#include <cmath>
+
+// Changes of Re(Z) smaller than this fraction of its span count as flat
+static constexpr fvalue FLAT_REAL = 0.01;
+// Spectra with a phase below this at every point are purely resistive and have an empty drt
+static constexpr fvalue FLAT_PHASE = M_PI/360;
+
+// An arc is open at edge if -Im(Z) is still rising toward the edge while Re(Z) still changes,
+// a closed arc falls toward the real axis or has flattened out at the edge
+static bool openArc(const eis::DataPoint& edge, const eis::DataPoint& next, fvalue realSpan)
+{
+	fvalue reactance = -edge.im.imag();
+	bool rising = reactance > 0 && reactance > -next.im.imag();
+	bool flat = std::abs(edge.im.real() - next.im.real()) <= FLAT_REAL*realSpan;
+	return rising && !flat;
+}
+
+DrtScreenResult screenDrtCandidate(const std::vector<eis::DataPoint>& data)
+{
+	if(data.size() < 3)
+		return DRT_SCREEN_PASS;
+
+	bool flat = std::all_of(data.begin(), data.end(),
+		[](const eis::DataPoint& point){return std::abs(std::arg(point.im)) < FLAT_PHASE;});
+	if(flat)
+		return DRT_SCREEN_EMPTY;
+
+	auto [minReal, maxReal] = std::minmax_element(data.begin(), data.end(),
+		[](const eis::DataPoint& a, const eis::DataPoint& b){return a.im.real() < b.im.real();});
+	fvalue realSpan = maxReal->im.real() - minReal->im.real();
+
+	bool ascending = data.front().omega < data.back().omega;
+	const eis::DataPoint& low = ascending ? data[0] : data[data.size()-1];
+	const eis::DataPoint& lowNext = ascending ? data[1] : data[data.size()-2];
+	const eis::DataPoint& high = ascending ? data[data.size()-1] : data[0];
+	const eis::DataPoint& highNext = ascending ? data[data.size()-2] : data[1];
+
+	if(openArc(low, lowNext, realSpan))
+		return DRT_SCREEN_LOW_SIDE;
+	if(openArc(high, highNext, realSpan))
+		return DRT_SCREEN_HIGH_SIDE;
+	return DRT_SCREEN_PASS;
+}
@@ -0,0 +1,38 @@
+/* * KissDatasetGenerator - A generator of datasets for TorchKissAnn
+ * Copyright (C) 2025 Carl Klemm <carl@uvos.xyz>
+ *
+ * This file is part of KissDatasetGenerator.
+ *
+ * KissDatasetGenerator is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * KissDatasetGenerator is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with KissDatasetGenerator.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+#include <vector>
+#include <kisstype/type.h>
+
+/*
+ * Cheap checks that reject candidate spectra whose drt would be discarded after fitting,
+ * so that the fit is not run for them. A relaxation whose arc is still open at an edge
+ * of the frequency range has its drt peak outside of the range, while an arc that closes
+ * inside the range, like that of a plain R||C, passes.
+ */
+enum DrtScreenResult
+{
+	DRT_SCREEN_PASS,
+	DRT_SCREEN_LOW_SIDE,
+	DRT_SCREEN_HIGH_SIDE,
+	DRT_SCREEN_EMPTY
+};
+
+DrtScreenResult screenDrtCandidate(const std::vector<eis::DataPoint>& data);
@@ -0,0 +1,118 @@
+//
+// KissDatasetGenerator - A generator of datasets for TorchKissAnn
+// Copyright (C) 2025 Carl Klemm <carl@uvos.xyz>
+//
+// This file is part of KissDatasetGenerator.
+//
+// KissDatasetGenerator is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// KissDatasetGenerator is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with KissDatasetGenerator.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include "hashset.h"
+
+#include <algorithm>
+
+static constexpr size_t MIN_SLOTS = 64;
+
+// Zero marks an empty slot, a zero key is tracked in Shard::hasZero instead
+static constexpr uint64_t EMPTY = 0;
+
+static size_t slotCountFor(size_t entries)
+{
+	size_t slots = MIN_SLOTS;
+	while(slots*3 < entries*4)
+		slots *= 2;
+	return slots;
+}
+
+ConcurrentHashSet::ConcurrentHashSet(size_t expectedSize)
+{
+	size_t slots = slotCountFor(std::min(expectedSize, MAX_EXPECTED_SIZE)/SHARD_COUNT + 1);
+	for(Shard& shard : shards)
+		shard.slots.assign(slots, EMPTY);
+}
+
+bool ConcurrentHashSet::insertSlot(std::vector<uint64_t>& slots, uint64_t key)
+{
+	size_t mask = slots.size() - 1;
+	for(size_t i = key & mask;; i = (i + 1) & mask)
+	{
+		if(slots[i] == key)
+			return false;
+		if(slots[i] == EMPTY)
+		{
+			slots[i] = key;
+			return true;
+		}
+	}
+}
+
+void ConcurrentHashSet::grow(Shard& shard)
+{
+	std::vector<uint64_t> old(shard.slots.size()*2, EMPTY);
+	old.swap(shard.slots);
+	for(uint64_t key : old)
+	{
+		if(key != EMPTY)
+			insertSlot(shard.slots, key);
+	}
+}
+
+bool ConcurrentHashSet::insert(uint64_t key)
+{
+	Shard& shard = shards[key >> (64 - SHARD_BITS)];
+	std::scoped_lock lock(shard.mutex);
+
+	if(key == EMPTY)
+	{
+		bool inserted = !shard.hasZero;
+		shard.hasZero = true;
+		return inserted;
+	}
+
+	if((shard.count + 1)*4 > shard.slots.size()*3)
+		grow(shard);
+
+	bool inserted = insertSlot(shard.slots, key);
+	if(inserted)
+		++shard.count;
+	return inserted;
+}
+
+bool ConcurrentHashSet::contains(uint64_t key)
+{
+	Shard& shard = shards[key >> (64 - SHARD_BITS)];
+	std::scoped_lock lock(shard.mutex);
+
+	if(key == EMPTY)
+		return shard.hasZero;
+
+	size_t mask = shard.slots.size() - 1;
+	for(size_t i = key & mask; shard.slots[i] != EMPTY; i = (i + 1) & mask)
+	{
+		if(shard.slots[i] == key)
+			return true;
+	}
+	return false;
+}
+
+size_t ConcurrentHashSet::size()
+{
+	size_t size = 0;
+	for(Shard& shard : shards)
+	{
+		std::scoped_lock lock(shard.mutex);
+		size += shard.count + shard.hasZero;
+	}
+	return size;
+}
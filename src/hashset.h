@@ -0,0 +1,65 @@
+/* * KissDatasetGenerator - A generator of datasets for TorchKissAnn
+ * Copyright (C) 2025 Carl Klemm <carl@uvos.xyz>
+ *
+ * This file is part of KissDatasetGenerator.
+ *
+ * KissDatasetGenerator is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * KissDatasetGenerator is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with KissDatasetGenerator.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+#include <mutex>
+#include <array>
+
+/*
+ * Set of 64 bit hash values that can be inserted into from many threads.
+ * The keys are expected to already be well distributed hashes, they are spread
+ * over independently locked shards by their top bits and stored in open
+ * addressing tables with linear probing, so every entry costs 11 to 22 bytes
+ * and a lock is held only for a handfull of probes.
+ */
+class ConcurrentHashSet
+{
+public:
+	static constexpr size_t SHARD_BITS = 6;
+	static constexpr size_t SHARD_COUNT = 1 << SHARD_BITS;
+	// Presizing is capped at this many entries, the shards grow beyond it on demand
+	static constexpr size_t MAX_EXPECTED_SIZE = 1 << 24;
+
+private:
+	struct alignas(64) Shard
+	{
+		std::mutex mutex;
+		std::vector<uint64_t> slots;
+		size_t count = 0;
+		bool hasZero = false;
+	};
+
+	std::array<Shard, SHARD_COUNT> shards;
+
+	static void grow(Shard& shard);
+	static bool insertSlot(std::vector<uint64_t>& slots, uint64_t key);
+
+public:
+	explicit ConcurrentHashSet(size_t expectedSize = 0);
+	ConcurrentHashSet(const ConcurrentHashSet& in) = delete;
+	ConcurrentHashSet& operator=(const ConcurrentHashSet& in) = delete;
+
+	// Returns false if the key was already present
+	bool insert(uint64_t key);
+	bool contains(uint64_t key);
+	size_t size();
+};
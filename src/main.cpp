@@ -27,10 +27,14 @@
 #include <sstream>
 #include <string>
 #include <thread>
+#include <atomic>
+#include <chrono>
 #include <mutex>
+#include <condition_variable>
 #include <cassert>
 #include <vector>
 #include <set>
+#include <algorithm>
 #include <fstream>
 
 #include "datasets/eisgendatanoise.h"
@@ -42,10 +46,13 @@
 #include "datasets/dirloader.h"
 #include "datasets/tarloader.h"
 #include "randomgen.h"
-#include "microtar.h"
+#include "tarwriter.h"
 #include "hash.h"
+#include "hashset.h"
 #include "tokenize.h"
 #include "ploting.h"
+#include "chunkscheduler.h"
+#include "npywriter.h"
 
 static bool checkDir(const std::filesystem::path& outDir)
 {
@@ -60,9 +67,13 @@ static bool checkDir(const std::filesystem::path& outDir)
 	return true;
 }
 
-static std::string constructFilename(const eis::Spectra& spectrum, int offset, const std::string& extension = ".csv")
+static uint64_t hashSpectra(const eis::Spectra& spectrum)
+{
+	return murmurHash64(spectrum.data.data(), spectrum.data.size()*sizeof(*spectrum.data.data()), 8371);
+}
+
+static std::string constructFilename(const eis::Spectra& spectrum, uint64_t hash, const std::string& extension = ".csv")
 {
-	uint64_t hash = murmurHash64(spectrum.data.data(), spectrum.data.size()*sizeof(*spectrum.data.data()), 8371) + offset;
 	std::string model = spectrum.model;
 	eis::purgeEisParamBrackets(model);
 	std::string filename(model);
@@ -72,26 +83,27 @@ static std::string constructFilename(const eis::Spectra& spectrum, int offset, c
 	return filename;
 }
 
-static bool save(const eis::Spectra& spectrum, const std::filesystem::path& outDir, std::mutex& saveMutex, std::set<std::string>& filenames, mtar_t* tar, bool saveImages)
+template <typename Writer>
+static bool save(const eis::Spectra& spectrum, const std::filesystem::path& outDir, ConcurrentHashSet& hashes, Writer* tar, bool saveImages)
 {
 	bool ret = true;
-	std::string filename = constructFilename(spectrum, 0);
+	uint64_t hash = hashSpectra(spectrum);
 
+	if(!hashes.insert(hash))
 	{
-		std::scoped_lock<std::mutex> lk(saveMutex);
-		if(filenames.count(filename) == 1)
+		Log(Log::WARN)<<"Dataset contains several spectra with the same hash "<<hash;
+		for(uint64_t i = 1;; ++i)
 		{
-			Log(Log::WARN)<<"Dataset contains several spectra with the same hash at "<<filename;
-			for(int i = 1;; ++i)
+			if(hashes.insert(hash + i))
 			{
-				filename = constructFilename(spectrum, i);
-				if(filenames.count(filename) == 0)
-					break;
+				hash += i;
+				break;
 			}
 		}
-		filenames.insert(filename);
 	}
 
+	std::string filename = constructFilename(spectrum, hash);
+
 	if(!tar)
 	{
 		try
@@ -115,112 +127,339 @@ static bool save(const eis::Spectra& spectrum, const std::filesystem::path& outD
 	{
 		std::stringstream ss;
 		spectrum.saveToStream(ss);
-
-		std::scoped_lock<std::mutex> lk(saveMutex);
-		mtar_write_file_header(tar, filename.c_str(), ss.str().size());
-		mtar_write_data(tar, ss.str().c_str(), ss.str().size());
+		ret = tar->writeFile(filename, ss.str(), &spectrum);
+		if(!ret)
+			Log(Log::ERROR)<<"Could not save "<<filename<<" to "<<tar->getPath();
 	}
 
 	return ret;
 }
 
-void threadFunc(EisDataset* dataset, size_t begin, size_t end, int testPercent, std::mutex* printMutex,
-				const std::filesystem::path outDir, std::mutex* saveMutex, std::set<std::string>* filenames,
-				mtar_t* traintar, mtar_t* testtar, bool eraseLabels, bool noNegative, bool saveImages, std::string overrideModel)
+struct ThreadStatistics
 {
-	printMutex->lock();
-	Log(Log::INFO)<<"Thread doing "<<begin<<" to "<<end-1;
-	printMutex->unlock();
-	int loggedFor = 0;
-	size_t dataSize = 0;
-	for(size_t i = begin; i < end; ++i)
+	size_t samples = 0;
+	size_t rejected = 0;
+	size_t chunks = 0;
+	std::chrono::duration<double> busy = std::chrono::duration<double>::zero();
+	std::string dataset;
+};
+
+struct ExportResult
+{
+	size_t samples = 0;
+	size_t rejected = 0;
+	std::vector<ShardInfo> trainShards;
+	std::vector<ShardInfo> testShards;
+	std::vector<std::pair<size_t, std::string>> classes;
+};
+
+struct ExportContext
+{
+	const Config& config;
+	bool eraseLabels;
+	TarWriter* traintar;
+	TarWriter* testtar;
+	ChunkScheduler scheduler;
+	ConcurrentHashSet hashes;
+	std::mutex printMutex;
+	std::atomic<int> loggedPercent = 0;
+	std::atomic<size_t> trainShardCounter = 0;
+	std::atomic<size_t> testShardCounter = 0;
+	std::mutex resultMutex;
+	std::vector<ShardInfo> trainShards;
+	std::vector<ShardInfo> testShards;
+	std::set<size_t> classes;
+
+	// Candidates below quota are always exported when valid, spare candidates above it
+	// only take the places of rejected ones. As the scheduler hands out candidates in order,
+	// all of the first kind are in flight before the first spare one is drawn.
+	size_t quota;
+	std::atomic<size_t> pending;
+	std::mutex spareMutex;
+	std::condition_variable spareCondition;
+	size_t pendingRejected = 0;
+	// places claimed by spare candidates that are generated or exported
+	size_t replaced = 0;
+	std::atomic<size_t> exported = 0;
+
+	ExportContext(const Config& config, size_t size, size_t candidates, size_t threadCount, TarWriter* traintar, TarWriter* testtar):
+	config(config), traintar(traintar), testtar(testtar), scheduler(candidates, threadCount),
+	hashes(config.format == FORMAT_CSV ? size : 0), quota(size), pending(size)
 	{
-		eis::Spectra spectrum = dataset->get(i);
-		if(spectrum.data.empty())
+		eraseLabels = config.selectLabels.empty() && config.selectLabelsSet;
+	}
+
+	// Called for every candidate that was generated, a rejected spare candidate gives its place back
+	void finishCandidate(bool spare, bool rejected)
+	{
+		if(spare)
 		{
-			std::scoped_lock lock(*printMutex);
-			Log(Log::WARN)<<"Skipping datapoint "<<i;
-			continue;
+			if(rejected)
+			{
+				{
+					std::scoped_lock lock(spareMutex);
+					--replaced;
+				}
+				spareCondition.notify_all();
+			}
+			return;
 		}
 
-		if(!overrideModel.empty())
-			spectrum.model = overrideModel;
-
-		if(eraseLabels)
+		bool last = pending.fetch_sub(1) == 1;
+		if(rejected || last)
 		{
-			spectrum.setLabels(std::vector<float>());
-			spectrum.labelNames = std::vector<std::string>();
+			{
+				std::scoped_lock lock(spareMutex);
+				if(rejected)
+					++pendingRejected;
+			}
+			spareCondition.notify_all();
 		}
-		else if(noNegative)
+	}
+
+	// Waits until places for spare candidates are known to be free or all regular candidates
+	// are done, then claims up to wanted places. Returns the number of places claimed,
+	// 0 if no place is left.
+	size_t claimSpares(size_t wanted)
+	{
+		std::unique_lock lock(spareMutex);
+		spareCondition.wait(lock, [this]{return replaced < pendingRejected || pending.load() == 0;});
+		size_t claimed = replaced < pendingRejected ? std::min(wanted, pendingRejected - replaced) : 0;
+		replaced += claimed;
+		return claimed;
+	}
+
+	bool sparesDone()
+	{
+		std::scoped_lock lock(spareMutex);
+		return pending.load() == 0 && replaced >= pendingRejected;
+	}
+};
+
+void threadFunc(EisDataset* dataset, ExportContext* context, ThreadStatistics* statistics)
+{
+	const Config& config = context->config;
+	ChunkScheduler& scheduler = context->scheduler;
+	size_t shardBytes = config.shardSize*1024*1024;
+	NpyShardWriter trainWriter(config.outDir/"train", "train", &context->trainShardCounter, shardBytes);
+	NpyShardWriter testWriter(config.outDir/"test", "test", &context->testShardCounter, shardBytes);
+	ShardedTarWriter trainTarShards(config.outDir.string() + "_train", &context->trainShardCounter, shardBytes);
+	ShardedTarWriter testTarShards(config.outDir.string() + "_test", &context->testShardCounter, shardBytes);
+	bool shardTar = config.tar && config.shardSize > 0;
+	BufferedTarWriter* traintar = context->traintar ? new BufferedTarWriter(context->traintar) : nullptr;
+	BufferedTarWriter* testtar = context->testtar ? new BufferedTarWriter(context->testtar) : nullptr;
+
+	bool npy = config.format == FORMAT_NPY;
+
+	size_t dataSize = 0;
+	size_t begin;
+	size_t end;
+	SpectraBatch batch;
+	eis::Spectra single;
+	bool done = false;
+	while(!done && scheduler.next(begin, end))
+	{
+		if(begin >= context->quota && context->sparesDone())
+			break;
+
+		std::chrono::steady_clock::time_point chunkStart = std::chrono::steady_clock::now();
+		// A chunk is worked on in ranges that hold either only regular or only spare candidates.
+		// Spare candidates are only generated once a place for them is claimed, so the range
+		// of spares is cut to the number of places that are still missing
+		for(size_t rangeBegin = begin; rangeBegin < end;)
 		{
-			bool skip = false;
-			for(double label : spectrum.labels)
+			size_t rangeEnd;
+			if(rangeBegin < context->quota)
+			{
+				rangeEnd = std::min(end, context->quota);
+			}
+			else
 			{
-				if(label < 0.0)
+				size_t claimed = context->claimSpares(end - rangeBegin);
+				if(claimed == 0)
 				{
-					skip = true;
+					done = true;
 					break;
 				}
+				rangeEnd = rangeBegin + claimed;
 			}
-			if(skip)
-				continue;
-		}
 
-		if(dataSize == 0)
-		{
-			dataSize = spectrum.data.size();
-		}
-		else if(dataSize != spectrum.data.size())
-		{
-			std::scoped_lock lock(*printMutex);
-			Log(Log::WARN)<<"Data at index "<<i<<" has size "<<spectrum.data.size()<<" but "<<dataSize<<" was expected!!";
-		}
+			// Npy shards are written from the arrays of a batch, tar and csv output needs whole
+			// spectra, so for these the examples are fetched one by one instead of copying them
+			// out of a batch again
+			if(npy)
+				dataset->getBatch(rangeBegin, rangeEnd, batch);
+			for(size_t j = 0; j < rangeEnd - rangeBegin; ++j)
+			{
+				size_t i = npy ? batch.index(j) : rangeBegin + j;
+				bool spare = i >= context->quota;
+				if(!npy)
+					single = dataset->get(i);
+				eis::Spectra& spectrum = npy ? batch.meta(j) : single;
+				size_t frequencies = npy ? batch.frequencies(j) : single.data.size();
+				if(frequencies == 0)
+				{
+					std::scoped_lock lock(context->printMutex);
+					Log(Log::DEBUG)<<"Rejected datapoint "<<i;
+					++statistics->rejected;
+					context->finishCandidate(spare, true);
+					continue;
+				}
+
+				if(!config.overrideModel.empty())
+					spectrum.model = config.overrideModel;
+
+				if(context->eraseLabels)
+				{
+					spectrum.setLabels(std::vector<float>());
+					spectrum.labelNames = std::vector<std::string>();
+				}
+				else if(config.noNegative)
+				{
+					bool skip = false;
+					for(double label : spectrum.labels)
+					{
+						if(label < 0.0)
+						{
+							skip = true;
+							break;
+						}
+					}
+					if(skip)
+					{
+						++statistics->rejected;
+						context->finishCandidate(spare, true);
+						continue;
+					}
+				}
 
-		bool test = (testPercent > 0 && rd::rand(100) < testPercent);
+				context->finishCandidate(spare, false);
 
-		if(test)
-			save(spectrum, outDir/"test", *saveMutex, *filenames, testtar, saveImages);
-		else
-			save(spectrum, outDir/"train", *saveMutex, *filenames, traintar, saveImages);
+				if(dataSize == 0)
+				{
+					dataSize = frequencies;
+				}
+				else if(dataSize != frequencies)
+				{
+					std::scoped_lock lock(context->printMutex);
+					Log(Log::WARN)<<"Data at index "<<i<<" has size "<<frequencies<<" but "<<dataSize<<" was expected!!";
+				}
 
-		int percent = ((i-begin)*100)/(end-begin);
-		if(percent != loggedFor)
+				bool test = (config.testPercent > 0 && rd::Generator(i, rd::STREAM_SPLIT).rand(100) < config.testPercent);
+
+				if(npy)
+				{
+					NpyShardWriter& writer = test ? testWriter : trainWriter;
+					writer.write(batch, j, dataset->classForIndex(i));
+				}
+				else if(shardTar)
+				{
+					ShardedTarWriter& writer = test ? testTarShards : trainTarShards;
+					save(spectrum, config.outDir, context->hashes, &writer, config.saveImages);
+				}
+				else if(test)
+				{
+					save(spectrum, config.outDir/"test", context->hashes, testtar, config.saveImages);
+				}
+				else
+				{
+					save(spectrum, config.outDir/"train", context->hashes, traintar, config.saveImages);
+				}
+				++statistics->samples;
+				++context->exported;
+			}
+			rangeBegin = rangeEnd;
+		}
+		statistics->busy += std::chrono::steady_clock::now() - chunkStart;
+		++statistics->chunks;
+
+		// Progress is measured against the requested number of examples, as the spare candidates
+		// are only used in part
+		size_t exported = context->exported.load(std::memory_order_relaxed);
+		int percent = (exported*100)/std::max<size_t>(context->quota, 1);
+		int logged = context->loggedPercent.load(std::memory_order_relaxed);
+		if(percent > logged && context->loggedPercent.compare_exchange_strong(logged, percent))
 		{
-			loggedFor = percent;
-			std::scoped_lock lock(*printMutex);
-			Log(Log::INFO)<<begin<<" -> "<<end<<' '<<percent<<'%';
+			std::scoped_lock lock(context->printMutex);
+			Log(Log::INFO)<<exported<<" of "<<context->quota<<' '<<percent<<'%';
 		}
 	}
+
+	trainWriter.close();
+	testWriter.close();
+	trainTarShards.close();
+	testTarShards.close();
+	delete traintar;
+	delete testtar;
+	{
+		std::scoped_lock lock(context->resultMutex);
+		context->trainShards.insert(context->trainShards.end(), trainWriter.getShards().begin(), trainWriter.getShards().end());
+		context->testShards.insert(context->testShards.end(), testWriter.getShards().begin(), testWriter.getShards().end());
+		context->trainShards.insert(context->trainShards.end(), trainTarShards.getShards().begin(), trainTarShards.getShards().end());
+		context->testShards.insert(context->testShards.end(), testTarShards.getShards().begin(), testTarShards.getShards().end());
+		context->classes.insert(trainWriter.getClasses().begin(), trainWriter.getClasses().end());
+		context->classes.insert(testWriter.getClasses().begin(), testWriter.getClasses().end());
+	}
+	statistics->dataset = dataset->getStatistics();
 	delete dataset;
 }
 
+static bool compareShards(const ShardInfo& a, const ShardInfo& b)
+{
+	return a.path < b.path;
+}
+
 template <typename Dataset>
-void exportDataset(Dataset& dataset, const Config& config, mtar_t* traintar, mtar_t* testtar)
+ExportResult exportDataset(Dataset& dataset, const Config& config, TarWriter* traintar, TarWriter* testtar)
 {
 	Log(Log::INFO)<<"Dataset size: "<<dataset.size()<<" "<<dataset.modelStringForClass(0);
 
-	std::mutex saveMutex;
-	std::mutex printMutex;
-	std::set<std::string> filenames;
-
 	std::vector<std::thread> threads;
-	size_t threadCount = std::thread::hardware_concurrency()*1.5;
-	size_t countPerThread = dataset.size()/threadCount;
-	size_t i = 0;
-
-	bool eraseLabels = config.selectLabels.empty() && config.selectLabelsSet;
+	size_t threadCount = config.threadCount;
+	if(threadCount == 0)
+		threadCount = std::max(std::thread::hardware_concurrency()*1.5, 1.0);
+	ExportContext context(config, dataset.size(), dataset.candidateCount(), threadCount, traintar, testtar);
+	std::vector<ThreadStatistics> statistics(threadCount);
 
-	Log(Log::INFO)<<"Spawing "<<threadCount<<" treads";
-	for(; i < threadCount-1; ++i)
-		threads.push_back(std::thread(threadFunc, new Dataset(dataset), i*countPerThread, (i+1)*countPerThread,
-									  config.testPercent, &printMutex, config.outDir, &saveMutex, &filenames,
-									  traintar, testtar, eraseLabels, config.noNegative, config.saveImages, config.overrideModel));
-	threads.push_back(std::thread(threadFunc, new Dataset(dataset), i*countPerThread, dataset.size(),
-									  config.testPercent, &printMutex, config.outDir, &saveMutex, &filenames,
-									  traintar, testtar, eraseLabels, config.noNegative, config.saveImages, config.overrideModel));
+	Log(Log::INFO)<<"Spawing "<<threadCount<<" treads working on chunks of "<<context.scheduler.getChunkSize()<<" examples";
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	for(size_t i = 0; i < threadCount; ++i)
+		threads.push_back(std::thread(threadFunc, new Dataset(dataset), &context, &statistics[i]));
 
 	for(std::thread& thread : threads)
 		thread.join();
+
+	std::chrono::duration<double> wall = std::chrono::steady_clock::now() - start;
+	Log(Log::INFO)<<"Export took "<<wall.count()<<"s";
+	for(size_t i = 0; i < statistics.size(); ++i)
+	{
+		double utilisation = wall.count() > 0 ? (statistics[i].busy.count()/wall.count())*100 : 100;
+		Log(Log::INFO)<<"Thread "<<i<<": "<<statistics[i].samples<<" examples in "<<statistics[i].chunks
+			<<" chunks, "<<utilisation<<"% utilisation"<<(statistics[i].dataset.empty() ? "" : ", ")<<statistics[i].dataset;
+	}
+
+	ExportResult result;
+	for(const ThreadStatistics& threadStatistics : statistics)
+	{
+		result.samples += threadStatistics.samples;
+		result.rejected += threadStatistics.rejected;
+	}
+	if(result.samples < dataset.size())
+	{
+		Log(Log::WARN)<<"Only "<<result.samples<<" of "<<dataset.size()<<" examples could be exported, "
+			<<result.rejected<<" of "<<dataset.candidateCount()<<" candidates were rejected";
+	}
+	else if(result.rejected > 0)
+	{
+		Log(Log::INFO)<<result.rejected<<" candidates were rejected and replaced";
+	}
+	result.trainShards = std::move(context.trainShards);
+	result.testShards = std::move(context.testShards);
+	std::sort(result.trainShards.begin(), result.trainShards.end(), compareShards);
+	std::sort(result.testShards.begin(), result.testShards.end(), compareShards);
+	for(size_t classNum : context.classes)
+		result.classes.push_back({classNum, dataset.modelStringForClass(classNum)});
+	return result;
 }
 
 std::pair<std::string, int> parseOption(std::string option)
@@ -284,13 +523,54 @@ void printDatasetHelp(DatasetMode datasetMode)
 	}
 }
 
-std::string getMetadata(const Config& config, size_t datasetSize, const std::string& role = "unkown")
+static void writeJsonStringArray(std::ostream& ss, const std::vector<std::string>& strings)
 {
+	ss<<'[';
+	for(size_t i = 0; i < strings.size(); ++i)
+		ss<<(i == 0 ? "" : ", ")<<'"'<<strings[i]<<'"';
+	ss<<']';
+}
+
+std::string getMetadata(const Config& config, const ExportResult& result, const std::string& role = "unkown",
+						const std::vector<ShardInfo>& shards = {}, const std::vector<std::pair<size_t, std::string>>& classes = {})
+{
+	size_t candidates = result.samples + result.rejected;
 	std::stringstream ss;
 	ss<<"{\n";
 	ss<<"\t\"DatasetType\" : \""<<datasetModeToStr(config.mode)<<"\",\n";
 	ss<<"\t\"DatasetOptions\" : \""<<config.dataOptions<<"\",\n";
-	ss<<"\t\"DatasetSize\" : "<<datasetSize<<",\n";
+	ss<<"\t\"DatasetSize\" : "<<result.samples<<",\n";
+	ss<<"\t\"RejectedCandidates\" : "<<result.rejected<<",\n";
+	ss<<"\t\"RejectionRate\" : "<<(candidates > 0 ? static_cast<double>(result.rejected)/candidates : 0.0)<<",\n";
+	ss<<"\t\"Seed\" : "<<rd::getSeed()<<",\n";
+	if(!shards.empty())
+	{
+		ss<<"\t\"Shards\" : [";
+		for(size_t i = 0; i < shards.size(); ++i)
+		{
+			ss<<(i == 0 ? "\n" : ",\n");
+			ss<<"\t\t{\"Path\" : \""<<shards[i].path.filename().string()<<"\", \"Size\" : "<<shards[i].size;
+			if(config.format == FORMAT_NPY)
+			{
+				ss<<", \"Frequencies\" : "<<shards[i].frequencies
+					<<", \"SharedOmega\" : "<<(shards[i].sharedOmega ? "true" : "false")<<", \"LabelNames\" : ";
+				writeJsonStringArray(ss, shards[i].labelNames);
+			}
+			ss<<'}';
+		}
+		ss<<"\n\t],\n";
+	}
+	if(config.format == FORMAT_NPY)
+	{
+		ss<<"\t\"Format\" : \""<<outputFormatToStr(config.format)<<"\",\n";
+		ss<<"\t\"Classes\" : [";
+		for(size_t i = 0; i < classes.size(); ++i)
+		{
+			ss<<(i == 0 ? "\n" : ",\n");
+			ss<<"\t\t{\"Id\" : "<<classes[i].first<<", \"Model\" : \""<<classes[i].second<<"\"}";
+		}
+		ss<<"\n\t],\n";
+	}
 	ss<<"\t\"DatasetRole\" : \""<<role<<"\"\n";
 	ss<<"}\n";
 	return ss.str();
@@ -309,6 +589,12 @@ int main(int argc, char** argv)
 		return 1;
 	}
 
+	if(config.seedSet)
+		rd::setSeed(config.seed);
+	else
+		rd::init();
+	Log(Log::INFO)<<"Using random seed "<<rd::getSeed();
+
 	if(config.printDatasetHelp)
 	{
 		printDatasetHelp(config.mode);
@@ -321,17 +607,27 @@ int main(int argc, char** argv)
 		return 1;
 	}
 
-	if(config.saveImages && config.tar)
+	if(config.format == FORMAT_INVALID)
+	{
+		Log(Log::ERROR)<<"A invalid output format was specified";
+		return 1;
+	}
+
+	// Binary shards are always written as directories
+	if(config.format == FORMAT_NPY)
+		config.tar = false;
+
+	if(config.saveImages && (config.tar || config.format != FORMAT_CSV))
 	{
-		Log(Log::ERROR)<<"Saveing images to tar is not implemented";
+		Log(Log::ERROR)<<"Saveing images is only implemented for csv files in a directory";
 		return 1;
 	}
 
 	std::vector<std::string> selectLabelKeys = config.selectLabels.empty() ? std::vector<std::string>() : tokenize(config.selectLabels, ',');
 	std::vector<std::string> extraInputKeys = config.extaInputs.empty() ? std::vector<std::string>() : tokenize(config.extaInputs, ',');
 
-	mtar_t* traintar = nullptr;
-	mtar_t* testtar = nullptr;
+	TarWriter* traintar = nullptr;
+	TarWriter* testtar = nullptr;
 	if(!config.tar)
 	{
 		bool ret = checkDir(config.outDir);
@@ -347,13 +643,12 @@ int main(int argc, char** argv)
 				return 3;
 		}
 	}
-	else
+	else if(config.shardSize == 0)
 	{
 		if(config.tar)
 		{
-			traintar = new mtar_t;
-			int ret = mtar_open(traintar, (config.outDir.string().append("_train.tar")).c_str(), "w");
-			if(ret != 0)
+			traintar = new TarWriter(config.outDir.string().append("_train.tar"));
+			if(!traintar->isOpen())
 			{
 				Log(Log::ERROR)<<"Could not create tar archive at "<<config.outDir.c_str();
 				delete traintar;
@@ -361,9 +656,8 @@ int main(int argc, char** argv)
 			}
 			if(config.testPercent > 0)
 			{
-				testtar = new mtar_t;
-				ret = mtar_open(testtar, (config.outDir.string() + "_test.tar").c_str(), "w");
-				if(ret != 0)
+				testtar = new TarWriter(config.outDir.string() + "_test.tar");
+				if(!testtar->isOpen())
 				{
 					Log(Log::ERROR)<<"Could not create tar archive at "<<config.outDir.c_str();
 					delete traintar;
@@ -371,7 +665,6 @@ int main(int argc, char** argv)
 					return 4;
 				}
 			}
-			config.outDir = "";
 		}
 	}
 
@@ -379,7 +672,7 @@ int main(int argc, char** argv)
 
 	Log(Log::INFO)<<"Exporting dataset of type "<<datasetModeToStr(config.mode);
 
-	size_t datasetSize = 0;
+	ExportResult result;
 
 	switch(config.mode)
 	{
@@ -390,8 +683,7 @@ int main(int argc, char** argv)
 			EisGeneratorDataset dataset(options, config.datasetPath, config.frequencyCount);
 			if(!config.range.empty())
 				dataset.setOmegaRange(eis::Range::fromString(config.range, config.frequencyCount));
-			exportDataset<EisGeneratorDataset>(dataset, config, traintar, testtar);
-			datasetSize = dataset.size();
+			result = exportDataset<EisGeneratorDataset>(dataset, config, traintar, testtar);
 		}
 		break;
 		case DATASET_PASSFAIL:
@@ -400,8 +692,7 @@ int main(int argc, char** argv)
 			if(!config.range.empty())
 				gendataset.setOmegaRange(eis::Range::fromString(config.range, config.frequencyCount));
 			PassFaillDataset dataset(&gendataset);
-			exportDataset<PassFaillDataset>(dataset, config, traintar, testtar);
-			datasetSize = dataset.size();
+			result = exportDataset<PassFaillDataset>(dataset, config, traintar, testtar);
 		}
 		break;
 		case DATASET_REGRESSION:
@@ -411,8 +702,7 @@ int main(int argc, char** argv)
 			ParameterRegressionDataset dataset(options, config.datasetPath, config.frequencyCount);
 			if(!config.range.empty())
 				dataset.setOmegaRange(eis::Range::fromString(config.range, config.frequencyCount));
-			exportDataset<ParameterRegressionDataset>(dataset, config, traintar, testtar);
-			datasetSize = dataset.size();
+			result = exportDataset<ParameterRegressionDataset>(dataset, config, traintar, testtar);
 		}
 		break;
 		case DATASET_DIR:
@@ -422,8 +712,7 @@ int main(int argc, char** argv)
 			EisDirDataset dataset(options, config.datasetPath, config.frequencyCount, selectLabelKeys, extraInputKeys);
 			size_t removed = dataset.removeLessThan(50);
 			Log(Log::INFO)<<"Removed "<<removed<<" spectra as there are not enough examples for this class";
-			exportDataset<EisDirDataset>(dataset, config, traintar, testtar);
-			datasetSize = dataset.size();
+			result = exportDataset<EisDirDataset>(dataset, config, traintar, testtar);
 		}
 		break;
 		case DATASET_TAR:
@@ -431,8 +720,7 @@ int main(int argc, char** argv)
 			if(!parseOptions<TarDataset>(config.dataOptions, options))
 				return 1;
 			TarDataset dataset(options, config.datasetPath, config.frequencyCount, selectLabelKeys, extraInputKeys);
-			exportDataset<TarDataset>(dataset, config, traintar, testtar);
-			datasetSize = dataset.size();
+			result = exportDataset<TarDataset>(dataset, config, traintar, testtar);
 		}
 		break;
 		default:
@@ -442,26 +730,41 @@ int main(int argc, char** argv)
 
 	if(traintar)
 	{
-		std::string metastr = getMetadata(config, datasetSize, "train");
-		mtar_write_file_header(traintar, "meta.json", metastr.size());
-		mtar_write_data(traintar, metastr.c_str(), metastr.size());
-		mtar_finalize(traintar);
+		std::string metastr = getMetadata(config, result, "train");
+		traintar->writeFile("meta.json", metastr);
+		traintar->finalize();
 		delete traintar;
 	}
 
 	if(testtar)
 	{
-		std::string metastr = getMetadata(config, datasetSize, "test");
-		mtar_write_file_header(testtar, "meta.json", metastr.size());
-		mtar_write_data(testtar, metastr.c_str(), metastr.size());
-		mtar_finalize(testtar);
+		std::string metastr = getMetadata(config, result, "test");
+		testtar->writeFile("meta.json", metastr);
+		testtar->finalize();
 		delete testtar;
 	}
 
+	if(config.tar && config.shardSize > 0)
+	{
+		for(const std::vector<ShardInfo>* shards : {&result.trainShards, &result.testShards})
+		{
+			std::string metastr = getMetadata(config, result, shards == &result.trainShards ? "train" : "test", *shards);
+			for(const ShardInfo& shard : *shards)
+			{
+				TarWriter tar(shard.path, true);
+				if(!tar.isOpen() || !tar.writeFile("meta.json", metastr) || !tar.finalize())
+				{
+					Log(Log::ERROR)<<"Could not finalize "<<shard.path;
+					return 1;
+				}
+			}
+		}
+	}
+
 	if(!config.tar)
 	{
 		{
-			std::string metastr = getMetadata(config, datasetSize, "train");
+			std::string metastr = getMetadata(config, result, "train", result.trainShards, result.classes);
 
 			std::filesystem::path metaPath = config.outDir/"train"/"meta.json";
 			std::ofstream file(metaPath);
@@ -476,7 +779,7 @@ int main(int argc, char** argv)
 
 		if(config.testPercent > 0)
 		{
-			std::string metastr = getMetadata(config, datasetSize, "test");
+			std::string metastr = getMetadata(config, result, "test", result.testShards, result.classes);
 
 			std::filesystem::path metaPath = config.outDir/"test"/"meta.json";
 			std::ofstream file(metaPath);
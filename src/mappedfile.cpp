@@ -0,0 +1,86 @@
+//
+// KissDatasetGenerator - A generator of datasets for TorchKissAnn
+// Copyright (C) 2025 Carl Klemm <carl@uvos.xyz>
+//
+// This file is part of KissDatasetGenerator.
+//
+// KissDatasetGenerator is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// KissDatasetGenerator is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with KissDatasetGenerator.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "mappedfile.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <cerrno>
+#include <cstring>
+
+#include "log.h"
+
+MappedFile::MappedFile(const std::filesystem::path& path)
+{
+	int fd = ::open(path.c_str(), O_RDONLY);
+	if(fd < 0)
+	{
+		Log(Log::ERROR)<<"Could not open "<<path<<": "<<strerror(errno);
+		return;
+	}
+
+	struct stat st;
+	if(fstat(fd, &st) != 0)
+	{
+		Log(Log::ERROR)<<"Could not stat "<<path<<": "<<strerror(errno);
+		close(fd);
+		return;
+	}
+
+	length = st.st_size;
+	if(length > 0)
+	{
+		void* mapping = mmap(nullptr, length, PROT_READ, MAP_SHARED, fd, 0);
+		if(mapping == MAP_FAILED)
+		{
+			Log(Log::ERROR)<<"Could not map "<<path<<": "<<strerror(errno);
+			close(fd);
+			length = 0;
+			return;
+		}
+		buffer = static_cast<const char*>(mapping);
+	}
+
+	// The mapping stays valid after the descriptor is closed
+	close(fd);
+	open = true;
+}
+
+MappedFile::~MappedFile()
+{
+	if(buffer)
+		munmap(const_cast<char*>(buffer), length);
+}
+
+bool MappedFile::isOpen() const
+{
+	return open;
+}
+
+const char* MappedFile::data() const
+{
+	return buffer;
+}
+
+size_t MappedFile::size() const
+{
+	return length;
+}
@@ -0,0 +1,70 @@
+/* * KissDatasetGenerator - A generator of datasets for TorchKissAnn
+ * Copyright (C) 2025 Carl Klemm <carl@uvos.xyz>
+ *
+ * This file is part of KissDatasetGenerator.
+ *
+ * KissDatasetGenerator is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * KissDatasetGenerator is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with KissDatasetGenerator.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+#include <cstddef>
+#include <istream>
+#include <streambuf>
+#include <filesystem>
+
+/*
+ * Read only memory mapping of a whole file. The mapping is immutable and can thus be
+ * shared between any number of threads, usually via a std::shared_ptr<const MappedFile>.
+ */
+class MappedFile
+{
+	const char* buffer = nullptr;
+	size_t length = 0;
+	bool open = false;
+
+public:
+	explicit MappedFile(const std::filesystem::path& path);
+	MappedFile(const MappedFile& in) = delete;
+	MappedFile& operator=(const MappedFile& in) = delete;
+	~MappedFile();
+
+	bool isOpen() const;
+	const char* data() const;
+	size_t size() const;
+};
+
+/*
+ * std::istream reading directly from a memory region without copying it.
+ */
+class MemoryStream : public std::istream
+{
+	class Buffer : public std::streambuf
+	{
+	public:
+		Buffer(const char* data, size_t size)
+		{
+			char* begin = const_cast<char*>(data);
+			setg(begin, begin, begin + size);
+		}
+	};
+
+	Buffer buffer;
+
+public:
+	MemoryStream(const char* data, size_t size):
+	std::istream(nullptr), buffer(data, size)
+	{
+		rdbuf(&buffer);
+	}
+};
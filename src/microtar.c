@@ -20,10 +20,13 @@
  * IN THE SOFTWARE.
  */
 
+#define _FILE_OFFSET_BITS 64
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <stddef.h>
 #include <string.h>
+#include <sys/types.h>
 
 #include "microtar.h"
 
@@ -37,11 +40,26 @@ typedef struct {
   char checksum[8];
   char type;
   char linkname[100];
-  char _padding[255];
+  char magic[6];
+  char version[2];
+  char uname[32];
+  char gname[32];
+  char devmajor[8];
+  char devminor[8];
+  char prefix[155];
+  char _padding[12];
 } mtar_raw_header_t;
 
+/* Largest value that fits the 11 octal digits of the size field */
+#define OCTAL_SIZE_MAX 077777777777ULL
+
+/* Upper bound for extension records we are willing to load */
+#define EXTENSION_MAX (1024 * 1024)
+
+#define PAX_HEADER_NAME "././@PaxHeader"
+
 
-static unsigned round_up(unsigned n, unsigned incr) {
+static mtar_size_t round_up(mtar_size_t n, mtar_size_t incr) {
   return n + (incr - n % incr) % incr;
 }
 
@@ -75,20 +93,87 @@ static int twrite(mtar_t *tar, const void *data, size_t size) {
 
 
 static int write_null_bytes(mtar_t *tar, int n) {
-  int i, err;
-  char nul = '\0';
-  for (i = 0; i < n; i++) {
-    err = twrite(tar, &nul, 1);
+  static const char zeros[MTAR_BLOCKSIZE * 2];
+  int err, len;
+  /* Padding and the trailer are written in as few blocks as possible */
+  while (n > 0) {
+    len = n < (int)sizeof(zeros) ? n : (int)sizeof(zeros);
+    err = twrite(tar, zeros, len);
     if (err) {
       return err;
     }
+    n -= len;
   }
   return MTAR_ESUCCESS;
 }
 
 
+/* Writes value as a NUL terminated octal string without leading zeros,
+ * like sprintf("%o") would, field must have room for 23 characters or be
+ * known to fit the value */
+static void write_octal(char *field, mtar_size_t value) {
+  char digits[24];
+  int n = 0;
+  do {
+    digits[n++] = (char)('0' + (value & 7));
+    value >>= 3;
+  } while (value);
+  while (n > 0) {
+    *field++ = digits[--n];
+  }
+  *field = '\0';
+}
+
+
+static mtar_size_t parse_number(const char *field, size_t len) {
+  size_t i = 0;
+  mtar_size_t res = 0;
+  /* GNU base-256 encoding, used for values that do not fit in octal */
+  if ((unsigned char)field[0] & 0x80) {
+    res = (unsigned char)field[0] & 0x7f;
+    for (i = 1; i < len; i++) {
+      res = (res << 8) | (unsigned char)field[i];
+    }
+    return res;
+  }
+  while (i < len && field[i] == ' ') {
+    i++;
+  }
+  for (; i < len && field[i] >= '0' && field[i] <= '7'; i++) {
+    res = (res << 3) | (mtar_size_t)(field[i] - '0');
+  }
+  return res;
+}
+
+
+static void format_number(char *field, size_t len, mtar_size_t value) {
+  size_t i;
+  if (value <= OCTAL_SIZE_MAX) {
+    write_octal(field, value);
+    return;
+  }
+  /* GNU base-256 encoding */
+  for (i = len - 1; i > 0; i--) {
+    field[i] = (char)(value & 0xff);
+    value >>= 8;
+  }
+  field[0] = (char)0x80;
+}
+
+
+static void copy_field(char *dst, size_t dst_len, const char *src, size_t src_len) {
+  size_t len = strnlen(src, src_len);
+  if (len >= dst_len) {
+    len = dst_len - 1;
+  }
+  memcpy(dst, src, len);
+  dst[len] = '\0';
+}
+
+
 static int raw_to_header(mtar_header_t *h, const mtar_raw_header_t *rh) {
   unsigned chksum1, chksum2;
+  size_t prefix_len;
 
   /* If the checksum starts with a null byte we assume the record is NULL */
   if (*rh->checksum == '\0') {
@@ -105,38 +190,172 @@ static int raw_to_header(mtar_header_t *h, const mtar_raw_header_t *rh) {
   /* Load raw header into header */
   sscanf(rh->mode, "%o", &h->mode);
   sscanf(rh->owner, "%o", &h->owner);
-  sscanf(rh->size, "%o", &h->size);
+  h->size = parse_number(rh->size, sizeof(rh->size));
   sscanf(rh->mtime, "%o", &h->mtime);
   h->type = rh->type;
-  strcpy(h->name, rh->name);
-  strcpy(h->linkname, rh->linkname);
+  copy_field(h->linkname, sizeof(h->linkname), rh->linkname, sizeof(rh->linkname));
+
+  /* ustar archives may split long names into prefix and name */
+  prefix_len = 0;
+  if (!memcmp(rh->magic, "ustar", 5) && rh->prefix[0] != '\0') {
+    copy_field(h->name, sizeof(h->name), rh->prefix, sizeof(rh->prefix));
+    prefix_len = strlen(h->name);
+    h->name[prefix_len++] = '/';
+  }
+  copy_field(h->name + prefix_len, sizeof(h->name) - prefix_len, rh->name, sizeof(rh->name));
 
   return MTAR_ESUCCESS;
 }
 
 
-static int header_to_raw(mtar_raw_header_t *rh, const mtar_header_t *h) {
+static int header_to_raw(mtar_raw_header_t *rh, const mtar_header_t *h, int ustar) {
   unsigned chksum;
+  int i;
 
-  /* Load header into raw header */
+  /* Load header into raw header, names that are too long are truncated here
+   * and stored in full in a preceding pax record */
   memset(rh, 0, sizeof(*rh));
-  sprintf(rh->mode, "%o", h->mode);
-  sprintf(rh->owner, "%o", h->owner);
-  sprintf(rh->size, "%o", h->size);
-  sprintf(rh->mtime, "%o", h->mtime);
+  write_octal(rh->mode, h->mode & 07777777);
+  write_octal(rh->owner, h->owner & 07777777);
+  format_number(rh->size, sizeof(rh->size), h->size);
+  write_octal(rh->mtime, h->mtime & OCTAL_SIZE_MAX);
   rh->type = h->type ? h->type : MTAR_TREG;
-  strcpy(rh->name, h->name);
-  strcpy(rh->linkname, h->linkname);
+  copy_field(rh->name, sizeof(rh->name), h->name, sizeof(h->name));
+  copy_field(rh->linkname, sizeof(rh->linkname), h->linkname, sizeof(h->linkname));
+  if (ustar) {
+    memcpy(rh->magic, "ustar", 6);
+    memcpy(rh->version, "00", 2);
+  }
 
-  /* Calculate and write checksum */
+  /* Calculate and write checksum as six zero padded octal digits */
   chksum = checksum(rh);
-  sprintf(rh->checksum, "%06o", chksum);
+  for (i = 5; i >= 0; i--) {
+    rh->checksum[i] = (char)('0' + (chksum & 7));
+    chksum >>= 3;
+  }
+  rh->checksum[6] = '\0';
   rh->checksum[7] = ' ';
 
   return MTAR_ESUCCESS;
 }
 
 
+static int needs_pax(const mtar_header_t *h) {
+  return strlen(h->name) >= sizeof(((mtar_raw_header_t*)0)->name) ||
+    strlen(h->linkname) >= sizeof(((mtar_raw_header_t*)0)->linkname) ||
+    h->size > OCTAL_SIZE_MAX;
+}
+
+
+static size_t digits(size_t n) {
+  size_t res = 1;
+  while (n >= 10) {
+    n /= 10;
+    res++;
+  }
+  return res;
+}
+
+
+/* Writes a "<len> <key>=<value>\n" record to out if out is not NULL,
+ * returns the length of the record */
+static size_t pax_record(char *out, const char *key, const char *value) {
+  size_t base = strlen(key) + strlen(value) + 3;
+  size_t len = base + digits(base);
+  if (digits(len) != digits(base)) {
+    len = base + digits(len);
+  }
+  if (out) {
+    sprintf(out, "%zu %s=%s\n", len, key, value);
+  }
+  return len;
+}
+
+
+static size_t pax_records(char *out, const mtar_header_t *h) {
+  char size[24];
+  size_t len = 0;
+  if (strlen(h->name) >= sizeof(((mtar_raw_header_t*)0)->name)) {
+    len += pax_record(out ? out + len : NULL, "path", h->name);
+  }
+  if (strlen(h->linkname) >= sizeof(((mtar_raw_header_t*)0)->linkname)) {
+    len += pax_record(out ? out + len : NULL, "linkpath", h->linkname);
+  }
+  if (h->size > OCTAL_SIZE_MAX) {
+    sprintf(size, "%llu", (unsigned long long)h->size);
+    len += pax_record(out ? out + len : NULL, "size", size);
+  }
+  return len;
+}
+
+
+static size_t header_span(const mtar_header_t *h) {
+  if (!needs_pax(h)) {
+    return sizeof(mtar_raw_header_t);
+  }
+  return sizeof(mtar_raw_header_t) * 2 + round_up(pax_records(NULL, h), MTAR_BLOCKSIZE);
+}
+
+
+/* Formats h and any extension records it needs into out, which must have
+ * room for header_span(h) bytes */
+static int format_header(char *out, const mtar_header_t *h) {
+  mtar_header_t *xh;
+  size_t len;
+  int ustar = needs_pax(h);
+
+  if (ustar) {
+    len = pax_records(NULL, h);
+    xh = calloc(1, sizeof(*xh));
+    if (!xh) {
+      return MTAR_EFAILURE;
+    }
+    strcpy(xh->name, PAX_HEADER_NAME);
+    xh->mode = 0644;
+    xh->size = len;
+    xh->type = MTAR_TPAX;
+    header_to_raw((mtar_raw_header_t*)out, xh, 1);
+    free(xh);
+    out += sizeof(mtar_raw_header_t);
+    memset(out, 0, round_up(len, MTAR_BLOCKSIZE));
+    pax_records(out, h);
+    out += round_up(len, MTAR_BLOCKSIZE);
+  }
+
+  return header_to_raw((mtar_raw_header_t*)out, h, ustar);
+}
+
+
+/* Applies the records of a pax extended header to h */
+static void apply_pax_records(mtar_header_t *h, const char *data, size_t size) {
+  const char *p = data;
+  const char *end = data + size;
+  while (p < end) {
+    const char *key, *value, *record_end;
+    char *num_end;
+    size_t len = strtoul(p, &num_end, 10);
+    if (num_end == p || *num_end != ' ' || len == 0 || len > (size_t)(end - p)) {
+      return;
+    }
+    record_end = p + len - 1;
+    key = num_end + 1;
+    value = memchr(key, '=', record_end - key);
+    if (value) {
+      size_t key_len = value - key;
+      value++;
+      if (key_len == 4 && !memcmp(key, "path", 4)) {
+        copy_field(h->name, sizeof(h->name), value, record_end - value);
+      } else if (key_len == 8 && !memcmp(key, "linkpath", 8)) {
+        copy_field(h->linkname, sizeof(h->linkname), value, record_end - value);
+      } else if (key_len == 4 && !memcmp(key, "size", 4)) {
+        h->size = strtoull(value, NULL, 10);
+      }
+    }
+    p += len;
+  }
+}
+
+
 const char* mtar_strerror(int err) {
   switch (err) {
     case MTAR_ESUCCESS     : return "success";
@@ -163,8 +382,8 @@ static int file_read(mtar_t *tar, void *data, size_t size) {
   return (res == size) ? MTAR_ESUCCESS : MTAR_EREADFAIL;
 }
 
-static int file_seek(mtar_t *tar, long offset) {
-  int res = fseek(tar->stream, offset, SEEK_SET);
+static int file_seek(mtar_t *tar, mtar_size_t offset) {
+  int res = fseeko(tar->stream, (off_t)offset, SEEK_SET);
   return (res == 0) ? MTAR_ESUCCESS : MTAR_ESEEKFAIL;
 }
 
@@ -213,7 +432,7 @@ int mtar_close(mtar_t *tar) {
 }
 
 
-int mtar_seek(mtar_t *tar, long pos) {
+int mtar_seek(mtar_t *tar, mtar_size_t pos) {
   int err = tar->seek(tar, pos);
   tar->pos = pos;
   return err;
@@ -228,7 +447,8 @@ int mtar_rewind(mtar_t *tar) {
 
 
 int mtar_next(mtar_t *tar) {
-  int err, n;
+  int err;
+  mtar_size_t n;
   mtar_header_t h;
   /* Load header */
   err = mtar_read_header(tar, &h);
@@ -236,7 +456,7 @@ int mtar_next(mtar_t *tar) {
     return err;
   }
   /* Seek to next record */
-  n = round_up(h.size, 512) + sizeof(mtar_raw_header_t);
+  n = round_up(h.size, 512) + tar->header_size;
   return mtar_seek(tar, tar->pos + n);
 }
 
@@ -270,20 +490,103 @@ int mtar_find(mtar_t *tar, const char *name, mtar_header_t *h) {
 int mtar_read_header(mtar_t *tar, mtar_header_t *h) {
   int err;
   mtar_raw_header_t rh;
+  char *ext = NULL;
+  char *long_name = NULL;
+  char *long_link = NULL;
+  mtar_header_t *pax = NULL;
   /* Save header position */
   tar->last_header = tar->pos;
-  /* Read raw header */
-  err = tread(tar, &rh, sizeof(rh));
-  if (err) {
+  for (;;) {
+    /* Read raw header */
+    err = tread(tar, &rh, sizeof(rh));
+    if (err) {
+      break;
+    }
+    err = raw_to_header(h, &rh);
+    if (err) {
+      break;
+    }
+    if (h->type != MTAR_TPAX && h->type != MTAR_TPAXG &&
+        h->type != MTAR_TGNULONGNAME && h->type != MTAR_TGNULONGLINK) {
+      break;
+    }
+    /* Load the extension record, it describes the header that follows */
+    if (h->size > EXTENSION_MAX) {
+      err = MTAR_EFAILURE;
+      break;
+    }
+    ext = malloc(h->size + 1);
+    if (!ext) {
+      err = MTAR_EFAILURE;
+      break;
+    }
+    err = tread(tar, ext, h->size);
+    if (err) {
+      break;
+    }
+    ext[h->size] = '\0';
+    err = mtar_seek(tar, tar->pos + round_up(h->size, 512) - h->size);
+    if (err) {
+      break;
+    }
+    if (h->type == MTAR_TPAX) {
+      if (!pax) {
+        pax = calloc(1, sizeof(*pax));
+        if (!pax) {
+          err = MTAR_EFAILURE;
+          break;
+        }
+        pax->size = (mtar_size_t)-1;
+      }
+      apply_pax_records(pax, ext, h->size);
+    } else if (h->type == MTAR_TGNULONGNAME) {
+      free(long_name);
+      long_name = ext;
+      ext = NULL;
+    } else if (h->type == MTAR_TGNULONGLINK) {
+      free(long_link);
+      long_link = ext;
+      ext = NULL;
+    }
+    free(ext);
+    ext = NULL;
+  }
+
+  if (!err) {
+    /* Apply extension records, pax takes precedence over the gnu ones */
+    if (long_name) {
+      copy_field(h->name, sizeof(h->name), long_name, strlen(long_name));
+    }
+    if (long_link) {
+      copy_field(h->linkname, sizeof(h->linkname), long_link, strlen(long_link));
+    }
+    if (pax) {
+      if (pax->name[0] != '\0') {
+        strcpy(h->name, pax->name);
+      }
+      if (pax->linkname[0] != '\0') {
+        strcpy(h->linkname, pax->linkname);
+      }
+      if (pax->size != (mtar_size_t)-1) {
+        h->size = pax->size;
+      }
+    }
+    tar->header_size = tar->pos - tar->last_header;
+  }
+
+  free(ext);
+  free(long_name);
+  free(long_link);
+  free(pax);
+
+  if (err == MTAR_EREADFAIL) {
     return err;
   }
   /* Seek back to start of header */
-  err = mtar_seek(tar, tar->last_header);
-  if (err) {
-    return err;
+  if (mtar_seek(tar, tar->last_header)) {
+    return MTAR_ESEEKFAIL;
   }
-  /* Load raw header into header struct and return */
-  return raw_to_header(h, &rh);
+  return err;
 }
 
 
@@ -299,7 +602,7 @@ int mtar_read_data(mtar_t *tar, void *ptr, size_t size) {
       return err;
     }
     /* Seek past header and init remaining data */
-    err = mtar_seek(tar, tar->pos + sizeof(mtar_raw_header_t));
+    err = mtar_seek(tar, tar->pos + tar->header_size);
     if (err) {
       return err;
     }
@@ -321,30 +624,85 @@ int mtar_read_data(mtar_t *tar, void *ptr, size_t size) {
 
 
 int mtar_write_header(mtar_t *tar, const mtar_header_t *h) {
+  int err;
+  char *buffer;
+  size_t span = header_span(h);
   mtar_raw_header_t rh;
-  /* Build raw header and write */
-  header_to_raw(&rh, h);
   tar->remaining_data = h->size;
-  return twrite(tar, &rh, sizeof(rh));
+  /* Build raw header and write */
+  if (span == sizeof(rh)) {
+    header_to_raw(&rh, h, 0);
+    return twrite(tar, &rh, sizeof(rh));
+  }
+  /* Header needs extension records */
+  buffer = malloc(span);
+  if (!buffer) {
+    return MTAR_EFAILURE;
+  }
+  err = format_header(buffer, h);
+  if (!err) {
+    err = twrite(tar, buffer, span);
+  }
+  free(buffer);
+  return err;
+}
+
+
+static int init_file_header(mtar_header_t *h, const char *name, mtar_size_t size) {
+  if (strlen(name) >= sizeof(h->name)) {
+    return MTAR_EFAILURE;
+  }
+  /* The name buffers are large, only clear what header_to_raw reads */
+  strcpy(h->name, name);
+  h->linkname[0] = '\0';
+  h->size = size;
+  h->type = MTAR_TREG;
+  h->mode = 0664;
+  h->owner = 0;
+  h->mtime = 0;
+  return MTAR_ESUCCESS;
 }
 
 
-int mtar_write_file_header(mtar_t *tar, const char *name, size_t size) {
+int mtar_write_file_header(mtar_t *tar, const char *name, mtar_size_t size) {
   mtar_header_t h;
   /* Build header */
-  memset(&h, 0, sizeof(h));
-  strcpy(h.name, name);
-  h.size = size;
-  h.type = MTAR_TREG;
-  h.mode = 0664;
+  int err = init_file_header(&h, name, size);
+  if (err) {
+    return err;
+  }
   /* Write header */
   return mtar_write_header(tar, &h);
 }
 
 
+size_t mtar_file_header_size(const char *name, mtar_size_t size) {
+  mtar_header_t h;
+  if (init_file_header(&h, name, size)) {
+    return 0;
+  }
+  return header_span(&h);
+}
+
+
+int mtar_format_file_header(void *raw, const char *name, mtar_size_t size) {
+  mtar_header_t h;
+  /* Build header */
+  int err = init_file_header(&h, name, size);
+  if (err) {
+    return err;
+  }
+  /* Format header and any extension records into the callers buffer */
+  return format_header((char*)raw, &h);
+}
+
+
 int mtar_write_dir_header(mtar_t *tar, const char *name) {
   mtar_header_t h;
   /* Build header */
+  if (strlen(name) >= sizeof(h.name)) {
+    return MTAR_EFAILURE;
+  }
   memset(&h, 0, sizeof(h));
   strcpy(h.name, name);
   h.type = MTAR_TDIR;
@@ -15,8 +15,13 @@ extern "C"
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
 
 #define MTAR_VERSION "0.1.0"
+#define MTAR_BLOCKSIZE 512
+#define MTAR_NAME_MAX 4096
+
+typedef uint64_t mtar_size_t;
 
 enum {
   MTAR_ESUCCESS     =  0,
@@ -37,17 +42,21 @@ enum {
   MTAR_TCHR   = '3',
   MTAR_TBLK   = '4',
   MTAR_TDIR   = '5',
-  MTAR_TFIFO  = '6'
+  MTAR_TFIFO  = '6',
+  MTAR_TPAX   = 'x',
+  MTAR_TPAXG  = 'g',
+  MTAR_TGNULONGNAME = 'L',
+  MTAR_TGNULONGLINK = 'K'
 };
 
 typedef struct {
   unsigned mode;
   unsigned owner;
-  unsigned size;
+  mtar_size_t size;
   unsigned mtime;
   unsigned type;
-  char name[100];
-  char linkname[100];
+  char name[MTAR_NAME_MAX];
+  char linkname[MTAR_NAME_MAX];
 } mtar_header_t;
 
 
@@ -56,12 +65,14 @@ typedef struct mtar_t mtar_t;
 struct mtar_t {
   int (*read)(mtar_t *tar, void *data, size_t size);
   int (*write)(mtar_t *tar, const void *data, size_t size);
-  int (*seek)(mtar_t *tar, long pos);
+  int (*seek)(mtar_t *tar, mtar_size_t pos);
   int (*close)(mtar_t *tar);
   FILE *stream;
-  size_t pos;
-  size_t remaining_data;
-  size_t last_header;
+  mtar_size_t pos;
+  mtar_size_t remaining_data;
+  mtar_size_t last_header;
+  /* Size of the last header including any extension records preceding it */
+  mtar_size_t header_size;
 };
 
 
@@ -70,7 +81,7 @@ const char* mtar_strerror(int err);
 int mtar_open(mtar_t *tar, const char *filename, const char *mode);
 int mtar_close(mtar_t *tar);
 
-int mtar_seek(mtar_t *tar, long pos);
+int mtar_seek(mtar_t *tar, mtar_size_t pos);
 int mtar_rewind(mtar_t *tar);
 int mtar_next(mtar_t *tar);
 int mtar_find(mtar_t *tar, const char *name, mtar_header_t *h);
@@ -78,7 +89,9 @@ int mtar_read_header(mtar_t *tar, mtar_header_t *h);
 int mtar_read_data(mtar_t *tar, void *ptr, size_t size);
 
 int mtar_write_header(mtar_t *tar, const mtar_header_t *h);
-int mtar_write_file_header(mtar_t *tar, const char *name, size_t size);
+int mtar_write_file_header(mtar_t *tar, const char *name, mtar_size_t size);
+size_t mtar_file_header_size(const char *name, mtar_size_t size);
+int mtar_format_file_header(void *raw, const char *name, mtar_size_t size);
 int mtar_write_dir_header(mtar_t *tar, const char *name);
 int mtar_write_data(mtar_t *tar, const void *data, size_t size);
 int mtar_finalize(mtar_t *tar);
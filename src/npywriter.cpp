@@ -0,0 +1,284 @@
+//
+// KissDatasetGenerator - A generator of datasets for TorchKissAnn
+// Copyright (C) 2025 Carl Klemm <carl@uvos.xyz>
+//
+// This file is part of KissDatasetGenerator.
+//
+// KissDatasetGenerator is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// KissDatasetGenerator is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with KissDatasetGenerator.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include "npywriter.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <iomanip>
+#include <sstream>
+
+#include "log.h"
+
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+static constexpr const char* FLOAT_DESCR = "<f4";
+static constexpr const char* INT_DESCR = "<i8";
+#else
+static constexpr const char* FLOAT_DESCR = ">f4";
+static constexpr const char* INT_DESCR = ">i8";
+#endif
+
+static size_t descrItemSize(const std::string& descr)
+{
+	return std::stoul(descr.substr(2));
+}
+
+bool NpyShardWriter::NpyFile::open(const std::filesystem::path& path, const std::string& descrIn, const std::vector<size_t>& rowShapeIn)
+{
+	descr = descrIn;
+	rowShape = rowShapeIn;
+	rows = 0;
+	rowSize = descrItemSize(descr);
+	for(size_t dim : rowShape)
+		rowSize *= dim;
+	file = fopen(path.c_str(), "wb");
+	if(!file)
+	{
+		Log(Log::ERROR)<<"Could not open "<<path<<" for writeing";
+		return false;
+	}
+	return writeHeader();
+}
+
+bool NpyShardWriter::NpyFile::writeHeader()
+{
+	std::stringstream ss;
+	ss<<"{'descr': '"<<descr<<"', 'fortran_order': False, 'shape': ("<<rows;
+	if(rowShape.empty())
+		ss<<',';
+	for(size_t dim : rowShape)
+		ss<<", "<<dim;
+	ss<<"), }";
+
+	std::string dict = ss.str();
+	size_t dictSize = HEADER_SIZE - 10;
+	if(dict.size() + 1 > dictSize)
+		return false;
+	dict.append(dictSize - dict.size() - 1, ' ');
+	dict.push_back('\n');
+
+	char preamble[10] = {'\x93', 'N', 'U', 'M', 'P', 'Y', 1, 0,
+		static_cast<char>(dictSize & 0xff), static_cast<char>(dictSize >> 8)};
+
+	if(fseek(file, 0, SEEK_SET) != 0)
+		return false;
+	if(fwrite(preamble, 1, sizeof(preamble), file) != sizeof(preamble))
+		return false;
+	if(fwrite(dict.data(), 1, dict.size(), file) != dict.size())
+		return false;
+	return fseek(file, 0, SEEK_END) == 0;
+}
+
+bool NpyShardWriter::NpyFile::writeRow(const void* data, size_t size)
+{
+	assert(size == rowSize);
+	++rows;
+	return fwrite(data, 1, size, file) == size;
+}
+
+bool NpyShardWriter::NpyFile::close()
+{
+	if(!file)
+		return true;
+	bool ret = writeHeader();
+	ret = fclose(file) == 0 && ret;
+	file = nullptr;
+	return ret;
+}
+
+bool NpyShardWriter::NpyFile::isOpen() const
+{
+	return file;
+}
+
+NpyShardWriter::NpyFile::~NpyFile()
+{
+	close();
+}
+
+NpyShardWriter::NpyShardWriter(const std::filesystem::path& dir, const std::string& prefix, std::atomic<size_t>* shardCounter, size_t maxBytes):
+dir(dir), prefix(prefix), shardCounter(shardCounter), maxBytes(maxBytes)
+{
+}
+
+NpyShardWriter::~NpyShardWriter()
+{
+	close();
+}
+
+bool NpyShardWriter::fitsShard(const Example& example) const
+{
+	const eis::Spectra& meta = example.meta;
+	if(example.frequencies != current.frequencies || meta.labels.size() != current.labelNames.size())
+		return false;
+	if(meta.labelNames != current.labelNames && !meta.labelNames.empty())
+		return false;
+
+	size_t exampleBytes = (example.frequencies*(current.sharedOmega ? 2 : 3) + meta.labels.size())*sizeof(float) + sizeof(int64_t);
+	return maxBytes == 0 || bytes + exampleBytes <= maxBytes;
+}
+
+bool NpyShardWriter::openShard(const Example& example)
+{
+	std::stringstream ss;
+	ss<<prefix<<'-'<<std::setw(5)<<std::setfill('0')<<shardCounter->fetch_add(1);
+
+	current = ShardInfo();
+	current.path = ss.str();
+	current.frequencies = example.frequencies;
+	current.labelNames = example.meta.labelNames;
+	current.labelNames.resize(example.meta.labels.size());
+	bytes = 0;
+
+	std::filesystem::path shardDir = dir/current.path;
+	std::error_code ec;
+	std::filesystem::create_directory(shardDir, ec);
+	if(ec)
+	{
+		Log(Log::ERROR)<<"Could not create "<<shardDir<<": "<<ec.message();
+		return false;
+	}
+
+	firstOmega.assign(example.omega, example.omega + example.frequencies);
+
+	shardOpen = re.open(shardDir/"re.npy", FLOAT_DESCR, {current.frequencies}) &&
+		im.open(shardDir/"im.npy", FLOAT_DESCR, {current.frequencies}) &&
+		labels.open(shardDir/"labels.npy", FLOAT_DESCR, {example.meta.labels.size()}) &&
+		classes.open(shardDir/"class.npy", INT_DESCR, {});
+	return shardOpen;
+}
+
+bool NpyShardWriter::writeColumn(NpyFile& file, const fvalue* data, size_t count)
+{
+	row.assign(data, data + count);
+	bytes += row.size()*sizeof(float);
+	return file.writeRow(row.data(), row.size()*sizeof(float));
+}
+
+bool NpyShardWriter::writeOmega(const Example& example)
+{
+	if(current.sharedOmega)
+	{
+		if(std::equal(firstOmega.begin(), firstOmega.end(), example.omega,
+			[](float a, fvalue b){return a == static_cast<float>(b);}))
+			return true;
+
+		// This example breaks the shared grid, from now on a grid is stored for every example
+		current.sharedOmega = false;
+		if(!omega.open(dir/current.path/"omega.npy", FLOAT_DESCR, {current.frequencies}))
+			return false;
+		for(size_t i = 0; i < current.size; ++i)
+		{
+			if(!omega.writeRow(firstOmega.data(), firstOmega.size()*sizeof(float)))
+				return false;
+		}
+		bytes += current.size*firstOmega.size()*sizeof(float);
+	}
+
+	return writeColumn(omega, example.omega, example.frequencies);
+}
+
+bool NpyShardWriter::write(const Example& example, size_t classNum)
+{
+	if(shardOpen && current.size > 0 && !fitsShard(example))
+	{
+		if(!closeShard())
+			return false;
+	}
+
+	if(!shardOpen && !openShard(example))
+		return false;
+
+	bool ret = writeOmega(example);
+	ret = ret && writeColumn(re, example.re, example.frequencies);
+	ret = ret && writeColumn(im, example.im, example.frequencies);
+
+	row.assign(example.meta.labels.begin(), example.meta.labels.end());
+	ret = ret && labels.writeRow(row.data(), row.size()*sizeof(float));
+
+	int64_t classVal = classNum;
+	ret = ret && classes.writeRow(&classVal, sizeof(classVal));
+
+	bytes += example.meta.labels.size()*sizeof(float) + sizeof(classVal);
+	++current.size;
+	seenClasses.insert(classNum);
+
+	if(!ret)
+		Log(Log::ERROR)<<"Could not write example to "<<dir/current.path;
+	return ret;
+}
+
+bool NpyShardWriter::write(const eis::Spectra& spectrum, size_t classNum)
+{
+	exampleOmega.resize(spectrum.data.size());
+	exampleRe.resize(spectrum.data.size());
+	exampleIm.resize(spectrum.data.size());
+	for(size_t i = 0; i < spectrum.data.size(); ++i)
+	{
+		exampleOmega[i] = spectrum.data[i].omega;
+		exampleRe[i] = spectrum.data[i].im.real();
+		exampleIm[i] = spectrum.data[i].im.imag();
+	}
+	return write({spectrum.data.size(), exampleOmega.data(), exampleRe.data(), exampleIm.data(), spectrum}, classNum);
+}
+
+bool NpyShardWriter::write(const SpectraBatch& batch, size_t sample, size_t classNum)
+{
+	return write({batch.frequencies(sample), batch.omega(sample), batch.real(sample), batch.imag(sample), batch.meta(sample)}, classNum);
+}
+
+bool NpyShardWriter::closeShard()
+{
+	if(!shardOpen)
+		return true;
+
+	bool ret = re.close() && im.close() && labels.close() && classes.close();
+
+	if(current.sharedOmega)
+	{
+		ret = ret && omega.open(dir/current.path/"omega.npy", FLOAT_DESCR, {});
+		for(size_t i = 0; i < firstOmega.size() && ret; ++i)
+			ret = omega.writeRow(&firstOmega[i], sizeof(float));
+	}
+	ret = omega.close() && ret;
+
+	if(!ret)
+		Log(Log::ERROR)<<"Could not finish shard "<<dir/current.path;
+
+	shards.push_back(current);
+	shardOpen = false;
+	return ret;
+}
+
+bool NpyShardWriter::close()
+{
+	return closeShard();
+}
+
+const std::vector<ShardInfo>& NpyShardWriter::getShards() const
+{
+	return shards;
+}
+
+const std::set<size_t>& NpyShardWriter::getClasses() const
+{
+	return seenClasses;
+}
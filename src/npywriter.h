@@ -0,0 +1,119 @@
+/* * KissDatasetGenerator - A generator of datasets for TorchKissAnn
+ * Copyright (C) 2025 Carl Klemm <carl@uvos.xyz>
+ *
+ * This file is part of KissDatasetGenerator.
+ *
+ * KissDatasetGenerator is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * KissDatasetGenerator is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with KissDatasetGenerator.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+#include <cstdio>
+#include <cstdint>
+#include <cstddef>
+#include <atomic>
+#include <set>
+#include <string>
+#include <vector>
+#include <filesystem>
+#include <kisstype/spectra.h>
+
+#include "shardinfo.h"
+#include "datasets/spectrabatch.h"
+
+/*
+ * Writes examples as fixed width binary tensors, a shard is a directory containing
+ * the npy files re.npy and im.npy [example][frequency] float32,
+ * labels.npy [example][label] float32, class.npy [example] int64 and omega.npy,
+ * which holds the frequency grid once [frequency] if it is the same for all examples
+ * in the shard and [example][frequency] otherwise.
+ * Rows are streamed to disk as they arrive and the array shapes are filled in when
+ * the shard is closed, so a writer never buffers more than one example.
+ * A writer is meant to be owned by a single thread.
+ */
+class NpyShardWriter
+{
+public:
+	static constexpr size_t HEADER_SIZE = 128;
+
+private:
+	class NpyFile
+	{
+		FILE* file = nullptr;
+		std::string descr;
+		std::vector<size_t> rowShape;
+		size_t rowSize = 0;
+		size_t rows = 0;
+
+		bool writeHeader();
+
+	public:
+		bool open(const std::filesystem::path& path, const std::string& descr, const std::vector<size_t>& rowShape);
+		bool writeRow(const void* data, size_t size);
+		bool close();
+		bool isOpen() const;
+		~NpyFile();
+	};
+
+	std::filesystem::path dir;
+	std::string prefix;
+	std::atomic<size_t>* shardCounter;
+	size_t maxBytes;
+
+	bool shardOpen = false;
+	ShardInfo current;
+	size_t bytes = 0;
+	NpyFile re;
+	NpyFile im;
+	NpyFile labels;
+	NpyFile classes;
+	NpyFile omega;
+	std::vector<float> firstOmega;
+	std::vector<float> row;
+	std::vector<ShardInfo> shards;
+	std::set<size_t> seenClasses;
+
+	// One example as contiguous arrays, the labels are taken from meta
+	struct Example
+	{
+		size_t frequencies;
+		const fvalue* omega;
+		const fvalue* re;
+		const fvalue* im;
+		const eis::Spectra& meta;
+	};
+	std::vector<fvalue> exampleOmega;
+	std::vector<fvalue> exampleRe;
+	std::vector<fvalue> exampleIm;
+
+	bool openShard(const Example& example);
+	bool closeShard();
+	bool fitsShard(const Example& example) const;
+	bool writeOmega(const Example& example);
+	bool writeColumn(NpyFile& file, const fvalue* data, size_t count);
+	bool write(const Example& example, size_t classNum);
+
+public:
+	NpyShardWriter(const std::filesystem::path& dir, const std::string& prefix, std::atomic<size_t>* shardCounter, size_t maxBytes);
+	NpyShardWriter(const NpyShardWriter& in) = delete;
+	NpyShardWriter& operator=(const NpyShardWriter& in) = delete;
+	~NpyShardWriter();
+
+	bool write(const eis::Spectra& spectrum, size_t classNum);
+	// Writes sample of batch straight from the batch arrays
+	bool write(const SpectraBatch& batch, size_t sample, size_t classNum);
+	bool close();
+
+	const std::vector<ShardInfo>& getShards() const;
+	const std::set<size_t>& getClasses() const;
+};
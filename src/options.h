@@ -19,6 +19,7 @@
 
 #pragma once
 #include <string>
+#include <cstdint>
 #include <argp.h>
 #include <iostream>
 #include <filesystem>
@@ -30,6 +31,44 @@ static char doc[] = "Application that checkes and conditions a dataset in an eis
 static char args_doc[] = "";
 #define DATASET_LIST "gen, passfail, regression, dir, tar"
 
+enum
+{
+	OPT_SEED = 1000,
+	OPT_FORMAT,
+	OPT_SHARD_SIZE
+};
+
+#define FORMAT_LIST "csv, npy"
+
+typedef enum
+{
+	FORMAT_INVALID = -1,
+	FORMAT_CSV = 0,
+	FORMAT_NPY
+} OutputFormat;
+
+static inline constexpr const char* outputFormatToStr(const OutputFormat format)
+{
+	switch(format)
+	{
+		case FORMAT_CSV:
+			return "csv";
+		case FORMAT_NPY:
+			return "npy";
+		default:
+			return "invalid";
+	}
+}
+
+static inline OutputFormat parseOutputFormat(const std::string& in)
+{
+	if(in.empty() || in == outputFormatToStr(FORMAT_CSV))
+		return FORMAT_CSV;
+	else if(in == outputFormatToStr(FORMAT_NPY))
+		return FORMAT_NPY;
+	return FORMAT_INVALID;
+}
+
 typedef enum
 {
 	DATASET_INVALID = -1,
@@ -92,6 +131,11 @@ struct Config
 	bool saveImages = false;
 	bool noNegative = false;
 	bool printDatasetHelp = false;
+	size_t threadCount = 0;
+	uint64_t seed = 0;
+	bool seedSet = false;
+	OutputFormat format = FORMAT_CSV;
+	size_t shardSize = 0;
 };
 
 static struct argp_option options[] =
@@ -112,6 +156,10 @@ static struct argp_option options[] =
   {"no-negative",		'g', 0,	0,	"remove examples with negative labels from the dataset"},
   {"images",			'i', 0,	0,	"save a plot for eatch spectra"},
   {"assign-model",		'z', "[MODEL]",	0,	"assign this model to all spectra"},
+  {"seed",				OPT_SEED, "[NUMBER]",	0,	"seed for the random number generator, by default a random seed is used"},
+  {"format",			OPT_FORMAT, "[FORMAT]",	0,	"output format valid formats: " FORMAT_LIST ", npy writes shards of binary npy arrays into a directory"},
+  {"shard-size",		OPT_SHARD_SIZE, "[MIB]",	0,	"maximum size of an output shard in MiB for tar and npy output, default: unlimited"},
+  {"threads",			'j', "[NUMBER]",	0,	"the number of worker threads to use, default: 1.5 times the number of cpu cores"},
   { 0 }
 };
 
@@ -188,6 +236,19 @@ static error_t parse_opt (int key, char *arg, struct argp_state *state)
 		case 'z':
 			config->overrideModel = arg;
 			break;
+		case 'j':
+			config->threadCount = std::stoul(std::string(arg));
+			break;
+		case OPT_FORMAT:
+			config->format = parseOutputFormat(std::string(arg));
+			break;
+		case OPT_SHARD_SIZE:
+			config->shardSize = std::stoul(std::string(arg));
+			break;
+		case OPT_SEED:
+			config->seed = std::stoull(std::string(arg));
+			config->seedSet = true;
+			break;
 		default:
 			return ARGP_ERR_UNKNOWN;
 		}
@@ -0,0 +1,78 @@
+/* * KissDatasetGenerator - A generator of datasets for TorchKissAnn
+ * Copyright (C) 2025 Carl Klemm <carl@uvos.xyz>
+ *
+ * This file is part of KissDatasetGenerator.
+ *
+ * KissDatasetGenerator is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * KissDatasetGenerator is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with KissDatasetGenerator.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+#include <algorithm>
+#include <cstddef>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "chunkscheduler.h"
+
+/*
+ * Calls func(i) for every i in [0, count) spread over threadCount threads,
+ * or std::thread::hardware_concurrency() threads if threadCount is 0.
+ * func must be safe to call concurrently for different indices.
+ * If func throws, the first exception is rethrown in the calling thread once all
+ * threads have finished.
+ */
+template <typename Func>
+void parallelFor(size_t count, Func func, size_t threadCount = 0)
+{
+	if(threadCount == 0)
+		threadCount = std::max(std::thread::hardware_concurrency(), 1u);
+	threadCount = std::min(threadCount, count);
+
+	ChunkScheduler scheduler(count, threadCount);
+	std::mutex exceptionMutex;
+	std::exception_ptr exception;
+	auto worker = [&]()
+	{
+		try
+		{
+			size_t begin;
+			size_t end;
+			while(scheduler.next(begin, end))
+			{
+				for(size_t i = begin; i < end; ++i)
+					func(i);
+			}
+		}
+		catch(...)
+		{
+			std::scoped_lock lock(exceptionMutex);
+			if(!exception)
+				exception = std::current_exception();
+		}
+	};
+
+	std::vector<std::thread> threads;
+	if(threadCount > 1)
+		threads.reserve(threadCount - 1);
+	for(size_t i = 0; i + 1 < threadCount; ++i)
+		threads.emplace_back(worker);
+	worker();
+	for(std::thread& thread : threads)
+		thread.join();
+
+	if(exception)
+		std::rethrow_exception(exception);
+}
@@ -0,0 +1,146 @@
+//
+// KissDatasetGenerator - A generator of datasets for TorchKissAnn
+// Copyright (C) 2025 Carl Klemm <carl@uvos.xyz>
+//
+// This file is part of KissDatasetGenerator.
+//
+// KissDatasetGenerator is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// KissDatasetGenerator is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with KissDatasetGenerator.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "paramcache.h"
+
+#include <unistd.h>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <iterator>
+#include <sstream>
+#include <iomanip>
+#include <thread>
+#include <system_error>
+
+#include "hash.h"
+#include "log.h"
+#include "binaryio.h"
+
+namespace paramcache
+{
+
+static constexpr char MAGIC[8] = {'K', 'D', 'G', 'P', 'I', 'D', 'X', '\0'};
+static constexpr uint32_t VERSION = 1;
+
+std::filesystem::path getCacheDir()
+{
+	const char* xdgCache = std::getenv("XDG_CACHE_HOME");
+	if(xdgCache && xdgCache[0] != '\0')
+		return std::filesystem::path(xdgCache)/"kissdatasetgenerator";
+
+	const char* home = std::getenv("HOME");
+	if(home && home[0] != '\0')
+		return std::filesystem::path(home)/".cache"/"kissdatasetgenerator";
+
+	return std::filesystem::path();
+}
+
+static std::filesystem::path entryPath(const std::filesystem::path& dir, const std::string& key)
+{
+	std::stringstream ss;
+	ss<<std::hex<<std::setw(16)<<std::setfill('0')<<murmurHash64(key.data(), key.size(), 0)<<".idx";
+	return dir/ss.str();
+}
+
+bool load(const std::string& key, std::vector<size_t>& indices)
+{
+	std::filesystem::path dir = getCacheDir();
+	if(dir.empty())
+		return false;
+
+	std::ifstream file(entryPath(dir, key), std::ios::binary);
+	if(!file.is_open())
+		return false;
+	std::string data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+	BinaryReader reader(data.data(), data.size());
+	if(!reader.expect(MAGIC, sizeof(MAGIC)) || reader.u32() != VERSION || reader.string() != key)
+		return false;
+
+	// Indices are stored as zigzag encoded deltas
+	uint64_t count = reader.u64();
+	std::vector<size_t> result;
+	result.reserve(std::min<uint64_t>(count, data.size()));
+	int64_t previous = 0;
+	for(uint64_t i = 0; i < count && !reader.fail(); ++i)
+	{
+		uint64_t zigzag = reader.varint();
+		int64_t delta = static_cast<int64_t>(zigzag >> 1) ^ -static_cast<int64_t>(zigzag & 1);
+		previous += delta;
+		result.push_back(static_cast<size_t>(previous));
+	}
+
+	if(reader.fail() || !reader.atEnd())
+		return false;
+	indices = std::move(result);
+	return true;
+}
+
+void store(const std::string& key, const std::vector<size_t>& indices)
+{
+	std::filesystem::path dir = getCacheDir();
+	if(dir.empty())
+		return;
+
+	std::error_code ec;
+	std::filesystem::create_directories(dir, ec);
+	if(ec)
+	{
+		Log(Log::DEBUG)<<"Could not create cache directory "<<dir<<": "<<ec.message();
+		return;
+	}
+
+	std::string out(MAGIC, sizeof(MAGIC));
+	putU32(out, VERSION);
+	putString(out, key);
+	putU64(out, indices.size());
+	int64_t previous = 0;
+	for(size_t index : indices)
+	{
+		int64_t delta = static_cast<int64_t>(index) - previous;
+		putVarint(out, (static_cast<uint64_t>(delta) << 1) ^ static_cast<uint64_t>(delta >> 63));
+		previous = static_cast<int64_t>(index);
+	}
+
+	// Several threads or processes may store the same entry at once, each writes
+	// its own temporary file and the last rename wins
+	std::filesystem::path path = entryPath(dir, key);
+	std::stringstream tmpName;
+	tmpName<<path.string()<<'.'<<getpid()<<'.'<<std::this_thread::get_id()<<".tmp";
+	std::filesystem::path tmpPath = tmpName.str();
+	{
+		std::ofstream file(tmpPath, std::ios::binary | std::ios::trunc);
+		if(!file.is_open() || !file.write(out.data(), out.size()))
+		{
+			Log(Log::DEBUG)<<"Could not write "<<tmpPath;
+			std::filesystem::remove(tmpPath, ec);
+			return;
+		}
+	}
+
+	std::filesystem::rename(tmpPath, path, ec);
+	if(ec)
+	{
+		Log(Log::DEBUG)<<"Could not write "<<path<<": "<<ec.message();
+		std::filesystem::remove(tmpPath, ec);
+	}
+}
+
+}
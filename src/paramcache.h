@@ -0,0 +1,42 @@
+/* * KissDatasetGenerator - A generator of datasets for TorchKissAnn
+ * Copyright (C) 2025 Carl Klemm <carl@uvos.xyz>
+ *
+ * This file is part of KissDatasetGenerator.
+ *
+ * KissDatasetGenerator is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * KissDatasetGenerator is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with KissDatasetGenerator.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+#include <cstddef>
+#include <string>
+#include <vector>
+#include <filesystem>
+
+/*
+ * Content addressed on disk cache for the results of eis::Model::getRecommendedParamIndices.
+ * Entries live in $XDG_CACHE_HOME/kissdatasetgenerator or ~/.cache/kissdatasetgenerator,
+ * are named after a hash of a key string that describes all inputs of the computation
+ * and store the key itself, so that a hash collision is detected rather than returning
+ * the indices of a different model.
+ */
+namespace paramcache
+{
+
+// Returns an empty path if no cache directory can be determined
+std::filesystem::path getCacheDir();
+
+bool load(const std::string& key, std::vector<size_t>& indices);
+void store(const std::string& key, const std::vector<size_t>& indices);
+
+}
@@ -19,27 +19,57 @@
 //
 
 #include "randomgen.h"
-#include <assert.h>
-#include <cstddef>
-#include <cstdint>
+#include <cmath>
 #include <random>
 
-static std::default_random_engine randomEngine;
-static std::uniform_real_distribution<double> dist(0, 1);
-static std::uniform_int_distribution<size_t> distSt(0, SIZE_MAX);
+static constexpr uint64_t GOLDEN_GAMMA = 0x9e3779b97f4a7c15;
 
-double rd::rand(double max)
+// Only written before any worker threads are started
+static uint64_t globalSeed = 0;
+
+static uint64_t mix(uint64_t z)
+{
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+	return z ^ (z >> 31);
+}
+
+// Variant 0 yields the same sequence as before variants existed
+rd::Generator::Generator(uint64_t index, uint64_t stream, uint64_t variant):
+state(mix(mix(globalSeed ^ mix(stream*GOLDEN_GAMMA + variant*0xd1b54a32d192ed03)) + index))
+{
+}
+
+uint64_t rd::Generator::next()
+{
+	state += GOLDEN_GAMMA;
+	return mix(state);
+}
+
+double rd::Generator::rand(double max)
+{
+	return (next() >> 11)*0x1.0p-53*max;
+}
+
+double rd::Generator::normal()
+{
+	double u1 = 1.0 - rand();
+	double u2 = rand();
+	return std::sqrt(-2.0*std::log(u1))*std::cos(2.0*M_PI*u2);
+}
+
+void rd::setSeed(uint64_t seed)
 {
-	return dist(randomEngine)*max;
+	globalSeed = seed;
 }
 
-size_t rd::uid()
+uint64_t rd::getSeed()
 {
-	return distSt(randomEngine);
+	return globalSeed;
 }
 
 void rd::init()
 {
 	std::random_device randomDevice;
-	randomEngine.seed(randomDevice());
+	globalSeed = (static_cast<uint64_t>(randomDevice()) << 32) | randomDevice();
 }
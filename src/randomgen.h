@@ -20,9 +20,37 @@
 #pragma once
 
 #include <cstddef>
+#include <cstdint>
+
 namespace rd
 {
-double rand(double max = 1);
+
+enum Stream : uint64_t
+{
+	STREAM_SPLIT = 1,
+	STREAM_PERTURBATION,
+	STREAM_NOISE
+};
+
+/*
+ * Counter based SplitMix64 generator, every (global seed, index, stream) triple
+ * yields its own independent sequence. This makes the random numbers drawn for
+ * a given example independent of which thread processes it and of the order
+ * examples are processed in, without any shared mutable state.
+ */
+class Generator
+{
+	uint64_t state;
+
+public:
+	// variant selects another independent sequence for the same index and stream
+	Generator(uint64_t index, uint64_t stream, uint64_t variant = 0);
+	uint64_t next();
+	double rand(double max = 1);
+	double normal();
+};
+
+void setSeed(uint64_t seed);
+uint64_t getSeed();
 void init();
-size_t uid();
 }
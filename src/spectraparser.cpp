@@ -0,0 +1,233 @@
+//
+// KissDatasetGenerator - A generator of datasets for TorchKissAnn
+// Copyright (C) 2025 Carl Klemm <carl@uvos.xyz>
+//
+// This file is part of KissDatasetGenerator.
+//
+// KissDatasetGenerator is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// KissDatasetGenerator is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with KissDatasetGenerator.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "spectraparser.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <cerrno>
+#include <algorithm>
+#include <charconv>
+#include <cstring>
+#include <limits>
+#include <string>
+#include <vector>
+
+#include "mappedfile.h"
+
+static const char* skipBlanks(const char* pos, const char* end)
+{
+	while(pos < end && (*pos == ' ' || *pos == '\t'))
+		++pos;
+	return pos;
+}
+
+static const char* parseValue(const char* pos, const char* end, fvalue& value)
+{
+	// Parse as double and narrow like kisstype does
+	double result;
+	std::from_chars_result ret = std::from_chars(skipBlanks(pos, end), end, result);
+	if(ret.ec != std::errc())
+		return nullptr;
+	value = static_cast<fvalue>(result);
+	return skipBlanks(ret.ptr, end);
+}
+
+// Parses a "omega, real, imaginary" row spanning [pos, end)
+static bool parseRow(const char* pos, const char* end, eis::DataPoint& point)
+{
+	fvalue omega;
+	fvalue real;
+	fvalue imag;
+
+	if(!(pos = parseValue(pos, end, omega)) || pos == end || *pos++ != ',')
+		return false;
+	if(!(pos = parseValue(pos, end, real)) || pos == end || *pos++ != ',')
+		return false;
+	if(!(pos = parseValue(pos, end, imag)))
+		return false;
+	if(pos < end && *pos == '\r')
+		++pos;
+	if(pos != end)
+		return false;
+
+	point.omega = omega;
+	point.im = std::complex<fvalue>(real, imag);
+	return true;
+}
+
+static eis::Spectra parseSlow(const char* data, size_t size)
+{
+	MemoryStream ss(data, size);
+	return eis::Spectra::loadFromStream(ss);
+}
+
+eis::Spectra parseSpectra(const char* data, size_t size)
+{
+	// Rows are collected last to first into storage that is kept per thread
+	thread_local std::vector<eis::DataPoint> rows;
+	rows.clear();
+
+	const char* end = data + size;
+	const char* lineEnd = end;
+	while(lineEnd > data && (lineEnd[-1] == '\n' || lineEnd[-1] == '\r'))
+		--lineEnd;
+
+	// Walk backwards over the trailing block of numeric rows, memrchr finds
+	// line breaks many bytes at a time
+	const char* firstRow = nullptr;
+	while(lineEnd > data)
+	{
+		const char* lineStart = static_cast<const char*>(memrchr(data, '\n', lineEnd - data));
+		lineStart = lineStart ? lineStart + 1 : data;
+
+		eis::DataPoint point;
+		if(!parseRow(lineStart, lineEnd, point))
+			break;
+		rows.push_back(point);
+		firstRow = lineStart;
+		lineEnd = lineStart > data ? lineStart - 1 : data;
+	}
+
+	if(rows.size() < 2 || firstRow == data)
+		return parseSlow(data, size);
+
+	// Let kisstype parse everything up to and including the first row
+	const char* prefixEnd = static_cast<const char*>(std::memchr(firstRow, '\n', end - firstRow));
+	prefixEnd = prefixEnd ? prefixEnd + 1 : end;
+	eis::Spectra spectra;
+	try
+	{
+		spectra = parseSlow(data, prefixEnd - data);
+	}
+	catch(const eis::file_error& err)
+	{
+		// A header line that happens to hold three numbers, like three labels, was taken
+		// for a row and the prefix was cut inside the header
+		return parseSlow(data, size);
+	}
+
+	const eis::DataPoint& first = rows.back();
+	if(spectra.data.size() != 1 || spectra.data[0].omega != first.omega || spectra.data[0].im != first.im)
+		return parseSlow(data, size);
+
+	spectra.data.reserve(rows.size());
+	for(size_t i = rows.size() - 1; i-- > 0;)
+		spectra.data.push_back(rows[i]);
+	return spectra;
+}
+
+// Reads up to limit bytes of the file at fd into buffer, returns the size of the file
+static size_t readFile(int fd, const std::filesystem::path& path, std::string& buffer, size_t limit)
+{
+	struct stat st;
+	if(fstat(fd, &st) != 0)
+		throw eis::file_error("can not stat " + path.string() + ": " + strerror(errno));
+
+	buffer.resize(std::min<size_t>(st.st_size, limit));
+	size_t done = 0;
+	while(done < buffer.size())
+	{
+		ssize_t ret = pread(fd, buffer.data() + done, buffer.size() - done, done);
+		if(ret < 0 && errno == EINTR)
+			continue;
+		if(ret <= 0)
+			throw eis::file_error("can not read " + path.string() + ": " + strerror(ret < 0 ? errno : EIO));
+		done += ret;
+	}
+	return st.st_size;
+}
+
+class FileDescriptor
+{
+	int fd;
+
+public:
+	explicit FileDescriptor(const std::filesystem::path& path)
+	{
+		fd = open(path.c_str(), O_RDONLY);
+		if(fd < 0)
+			throw eis::file_error("can not open " + path.string() + ": " + strerror(errno));
+	}
+	FileDescriptor(const FileDescriptor& in) = delete;
+	FileDescriptor& operator=(const FileDescriptor& in) = delete;
+	~FileDescriptor()
+	{
+		close(fd);
+	}
+	operator int() const
+	{
+		return fd;
+	}
+};
+
+eis::Spectra loadSpectraFile(const std::filesystem::path& path)
+{
+	thread_local std::string buffer;
+
+	FileDescriptor fd(path);
+	readFile(fd, path, buffer, std::numeric_limits<size_t>::max());
+	return parseSpectra(buffer.data(), buffer.size());
+}
+
+bool parseSpectraHeader(const char* data, size_t size, eis::Spectra& spectra)
+{
+	const char* end = data + size;
+	const char* lineStart = data;
+	bool previousIsRow = false;
+	const char* previousStart = nullptr;
+
+	// Find the first pair of consecutive rows, a label line may look like a row
+	// but is never directly followed by one
+	while(lineStart < end)
+	{
+		const char* lineEnd = static_cast<const char*>(std::memchr(lineStart, '\n', end - lineStart));
+		if(!lineEnd)
+			return false;
+
+		eis::DataPoint point;
+		bool isRow = parseRow(lineStart, lineEnd, point);
+		if(isRow && previousIsRow && previousStart != data)
+		{
+			spectra = parseSlow(data, lineStart - data);
+			return spectra.data.size() == 1;
+		}
+		previousIsRow = isRow;
+		previousStart = lineStart;
+		lineStart = lineEnd + 1;
+	}
+	return false;
+}
+
+eis::Spectra loadSpectraFileHeader(const std::filesystem::path& path)
+{
+	thread_local std::string buffer;
+
+	FileDescriptor fd(path);
+	eis::Spectra spectra;
+	for(size_t limit = 4096;; limit *= 4)
+	{
+		size_t fileSize = readFile(fd, path, buffer, limit);
+		if(parseSpectraHeader(buffer.data(), buffer.size(), spectra))
+			return spectra;
+		if(buffer.size() == fileSize)
+			return parseSpectra(buffer.data(), buffer.size());
+	}
+}
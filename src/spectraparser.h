@@ -0,0 +1,49 @@
+/* * KissDatasetGenerator - A generator of datasets for TorchKissAnn
+ * Copyright (C) 2025 Carl Klemm <carl@uvos.xyz>
+ *
+ * This file is part of KissDatasetGenerator.
+ *
+ * KissDatasetGenerator is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * KissDatasetGenerator is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with KissDatasetGenerator.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+#include <cstddef>
+#include <filesystem>
+#include <kisstype/spectra.h>
+
+/*
+ * Fast reader for spectra in the kisstype csv format.
+ * The omega, real, imaginary rows that make up the bulk of a file are parsed with
+ * std::from_chars directly from the buffer, the short metadata part in front of them
+ * is left to eis::Spectra::loadFromStream so that it is interpreted exactly like kisstype
+ * does. The first row is parsed both ways as a consistency check and any disagreement,
+ * or anything that does not look like the expected layout, makes these functions fall
+ * back to parsing the whole file with eis::Spectra::loadFromStream.
+ * Like loadFromStream these functions throw eis::file_error on invalid input.
+ */
+eis::Spectra parseSpectra(const char* data, size_t size);
+
+// Replacement for eis::Spectra::loadFromDisk that reads the file into a per-thread buffer
+eis::Spectra loadSpectraFile(const std::filesystem::path& path);
+
+/*
+ * Parses only the metadata of a spectrum, the model, header and labels, plus its first row.
+ * data may be just the start of the file, false is returned if it does not contain the
+ * metadata and the first two rows in full or if the layout is not recognized.
+ */
+bool parseSpectraHeader(const char* data, size_t size, eis::Spectra& spectra);
+
+// Reads only as much of a file as is needed to parse its metadata, see parseSpectraHeader,
+// the data of the returned spectrum is incomplete
+eis::Spectra loadSpectraFileHeader(const std::filesystem::path& path);
@@ -0,0 +1,243 @@
+//
+// KissDatasetGenerator - A generator of datasets for TorchKissAnn
+// Copyright (C) 2025 Carl Klemm <carl@uvos.xyz>
+//
+// This file is part of KissDatasetGenerator.
+//
+// KissDatasetGenerator is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// KissDatasetGenerator is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with KissDatasetGenerator.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "sweepstore.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#include <sstream>
+#include <system_error>
+
+#include "hash.h"
+#include "log.h"
+#include "binaryio.h"
+#include "paramcache.h"
+
+static constexpr char MAGIC[8] = {'K', 'D', 'G', 'S', 'W', 'E', 'E', 'P'};
+static constexpr uint32_t VERSION = 2;
+// magic, version and the width of the stored values
+static constexpr size_t FILE_HEADER_SIZE = sizeof(MAGIC) + 2*sizeof(uint32_t);
+// Every record starts with the size and a checksum of its payload
+static constexpr size_t RECORD_HEADER_SIZE = sizeof(uint32_t) + sizeof(uint64_t);
+
+static uint64_t keyHash(const std::string& key)
+{
+	return murmurHash64(key.data(), key.size(), 0);
+}
+
+SweepStore::SweepStore(const std::filesystem::path& path): path(path)
+{
+	// Only the process that creates the file writes the file header
+	int createFd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_EXCL, 0644);
+	if(createFd >= 0)
+	{
+		std::string header(MAGIC, sizeof(MAGIC));
+		putU32(header, VERSION);
+		putU32(header, sizeof(fvalue));
+		bool ret = ::write(createFd, header.data(), header.size()) == static_cast<ssize_t>(header.size());
+		close(createFd);
+		if(!ret)
+		{
+			Log(Log::WARN)<<"Could not write "<<path<<": "<<strerror(errno);
+			return;
+		}
+	}
+
+	fd = ::open(path.c_str(), O_WRONLY | O_APPEND);
+	if(fd < 0)
+	{
+		Log(Log::WARN)<<"Could not open "<<path<<": "<<strerror(errno);
+		return;
+	}
+
+	map = std::make_unique<const MappedFile>(path);
+	scan();
+}
+
+SweepStore::~SweepStore()
+{
+	if(fd >= 0)
+		close(fd);
+}
+
+void SweepStore::scan()
+{
+	if(!map->isOpen() || map->size() < FILE_HEADER_SIZE)
+		return;
+
+	BinaryReader header(map->data(), map->size());
+	if(!header.expect(MAGIC, sizeof(MAGIC)) || header.u32() != VERSION || header.u32() != sizeof(fvalue))
+	{
+		Log(Log::WARN)<<path<<" is not a sweep store of this version or value width, it will not be used";
+		close(fd);
+		fd = -1;
+		return;
+	}
+
+	size_t pos = FILE_HEADER_SIZE;
+	while(map->size() - pos >= RECORD_HEADER_SIZE)
+	{
+		BinaryReader reader(map->data() + pos, RECORD_HEADER_SIZE);
+		uint32_t payloadSize = reader.u32();
+		uint64_t checksum = reader.u64();
+		if(payloadSize > map->size() - pos - RECORD_HEADER_SIZE)
+			break;
+
+		const char* payload = map->data() + pos + RECORD_HEADER_SIZE;
+		if(murmurHash64(payload, payloadSize, 0) != checksum)
+		{
+			Log(Log::WARN)<<path<<" is corrupted at offset "<<pos<<", ignoreing the rest of the store";
+			break;
+		}
+
+		BinaryReader payloadReader(payload, payloadSize);
+		std::string key = payloadReader.string();
+		if(payloadReader.fail())
+			break;
+		offsets.insert({keyHash(key), pos});
+		pos += RECORD_HEADER_SIZE + payloadSize;
+	}
+
+	// Records appended after an invalid tail could never be found, so the tail is cut off
+	if(pos < map->size())
+	{
+		Log(Log::WARN)<<path<<" has an invalid tail of "<<map->size() - pos<<" bytes, truncateing it";
+		if(ftruncate(fd, pos) != 0)
+		{
+			Log(Log::WARN)<<"Could not truncate "<<path<<": "<<strerror(errno)<<", the sweep store will not be added to";
+			close(fd);
+			fd = -1;
+		}
+	}
+}
+
+bool SweepStore::isOpen() const
+{
+	return fd >= 0;
+}
+
+bool SweepStore::find(const std::string& key, Sweep& sweep) const
+{
+	auto search = offsets.find(keyHash(key));
+	if(search == offsets.end())
+		return false;
+
+	BinaryReader header(map->data() + search->second, RECORD_HEADER_SIZE);
+	uint32_t payloadSize = header.u32();
+	BinaryReader reader(map->data() + search->second + RECORD_HEADER_SIZE, payloadSize);
+	if(reader.string() != key)
+		return false;
+
+	sweep.modelStr = reader.string();
+	sweep.labels.resize(reader.u32());
+	for(fvalue& label : sweep.labels)
+		label = reader.f<fvalue>();
+	sweep.data.resize(reader.u32());
+	for(eis::DataPoint& point : sweep.data)
+	{
+		point.omega = reader.f<fvalue>();
+		fvalue real = reader.f<fvalue>();
+		fvalue imag = reader.f<fvalue>();
+		point.im = std::complex<fvalue>(real, imag);
+	}
+
+	return !reader.fail() && reader.atEnd();
+}
+
+void SweepStore::add(const std::string& key, const Sweep& sweep)
+{
+	if(fd < 0)
+		return;
+
+	// Several copies of a dataset may simulate the same sweep at once, only the first one is stored
+	std::scoped_lock lock(appendMutex);
+	Sweep existing;
+	if(appended.count(keyHash(key)) || find(key, existing))
+		return;
+
+	std::string record(RECORD_HEADER_SIZE, '\0');
+	putString(record, key);
+	putString(record, sweep.modelStr);
+	putU32(record, sweep.labels.size());
+	for(fvalue label : sweep.labels)
+		putFloat<fvalue>(record, label);
+	putU32(record, sweep.data.size());
+	for(const eis::DataPoint& point : sweep.data)
+	{
+		putFloat<fvalue>(record, point.omega);
+		putFloat<fvalue>(record, point.im.real());
+		putFloat<fvalue>(record, point.im.imag());
+	}
+
+	size_t payloadSize = record.size() - RECORD_HEADER_SIZE;
+	std::string header;
+	putU32(header, payloadSize);
+	putU64(header, murmurHash64(record.data() + RECORD_HEADER_SIZE, payloadSize, 0));
+	record.replace(0, RECORD_HEADER_SIZE, header);
+
+	// A single write to a file opened with O_APPEND is never interleaved with other appends
+	if(::write(fd, record.data(), record.size()) != static_cast<ssize_t>(record.size()))
+		Log(Log::DEBUG)<<"Could not append to "<<path<<": "<<strerror(errno);
+	else
+		appended.insert(keyHash(key));
+}
+
+size_t SweepStore::size() const
+{
+	return offsets.size();
+}
+
+std::string SweepStore::makeKey(const std::string& kind, const std::string& modelKey, size_t paramIndex,
+	const eis::Range& omega, bool normalized, const std::vector<std::string>& labelNames)
+{
+	std::stringstream ss;
+	ss.precision(9);
+	ss<<kind<<'\n'<<modelKey<<'\n'<<paramIndex<<'\n';
+	ss<<omega.start<<' '<<omega.end<<' '<<omega.count<<' '<<omega.log<<'\n';
+	ss<<normalized<<'\n';
+	for(const std::string& name : labelNames)
+		ss<<name<<',';
+	return ss.str();
+}
+
+std::shared_ptr<SweepStore> SweepStore::openDefault()
+{
+	std::filesystem::path dir = paramcache::getCacheDir();
+	if(dir.empty())
+	{
+		Log(Log::WARN)<<"No cache directory available, the sweep store is disabled";
+		return nullptr;
+	}
+
+	std::error_code ec;
+	std::filesystem::create_directories(dir, ec);
+	if(ec)
+	{
+		Log(Log::WARN)<<"Could not create cache directory "<<dir<<": "<<ec.message()<<", the sweep store is disabled";
+		return nullptr;
+	}
+
+	std::shared_ptr<SweepStore> store = std::make_shared<SweepStore>(dir/"sweeps.store");
+	if(!store->isOpen())
+		return nullptr;
+	Log(Log::INFO)<<"Using sweep store "<<dir/"sweeps.store"<<" with "<<store->size()<<" sweeps";
+	return store;
+}
@@ -0,0 +1,85 @@
+/* * KissDatasetGenerator - A generator of datasets for TorchKissAnn
+ * Copyright (C) 2025 Carl Klemm <carl@uvos.xyz>
+ *
+ * This file is part of KissDatasetGenerator.
+ *
+ * KissDatasetGenerator is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * KissDatasetGenerator is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with KissDatasetGenerator.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <unordered_set>
+#include <filesystem>
+#include <kisstype/type.h>
+
+#include "mappedfile.h"
+
+/*
+ * Persistent append only store of noise free sweeps, so that a re-export of the same
+ * models only needs to read the spectra instead of simulateing them again.
+ * Every record holds a key string describeing all inputs of the sweep, the model string
+ * with parameters, the labels and the data points. Records already on disk when the
+ * store is opened are found via the mapping of the file, records added afterwards
+ * are appended with a single O_APPEND write so that several threads and processes
+ * can add to the same store. A truncated or corrupted tail is cut off when the store is opened.
+ * Values are stored as fvalue, a store written by a build with a different fvalue width
+ * is not used.
+ */
+class SweepStore
+{
+public:
+	struct Sweep
+	{
+		std::vector<eis::DataPoint> data;
+		std::string modelStr;
+		std::vector<fvalue> labels;
+	};
+
+private:
+	std::filesystem::path path;
+	std::unique_ptr<const MappedFile> map;
+	std::unordered_map<uint64_t, size_t> offsets;
+	int fd = -1;
+	// Keys appended by this process, records added after the file was mapped can not be found
+	// but must not be appended a second time
+	std::mutex appendMutex;
+	std::unordered_set<uint64_t> appended;
+
+	void scan();
+
+public:
+	explicit SweepStore(const std::filesystem::path& path);
+	SweepStore(const SweepStore& in) = delete;
+	SweepStore& operator=(const SweepStore& in) = delete;
+	~SweepStore();
+
+	bool isOpen() const;
+	bool find(const std::string& key, Sweep& sweep) const;
+	void add(const std::string& key, const Sweep& sweep);
+	size_t size() const;
+
+	// modelKey has to identify the model and its parameter sweep ranges, kind names the dataset
+	// and labelNames the labels it stores, so that datasets that process sweeps differently never share records
+	static std::string makeKey(const std::string& kind, const std::string& modelKey, size_t paramIndex,
+		const eis::Range& omega, bool normalized, const std::vector<std::string>& labelNames = {});
+	// Opens the store in the cache directory, returns nullptr if this is not possible
+	static std::shared_ptr<SweepStore> openDefault();
+};
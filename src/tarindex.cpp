@@ -0,0 +1,237 @@
+//
+// KissDatasetGenerator - A generator of datasets for TorchKissAnn
+// Copyright (C) 2025 Carl Klemm <carl@uvos.xyz>
+//
+// This file is part of KissDatasetGenerator.
+//
+// KissDatasetGenerator is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// KissDatasetGenerator is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with KissDatasetGenerator.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "tarindex.h"
+
+#include <algorithm>
+#include <fstream>
+#include <iterator>
+#include <system_error>
+
+#include "log.h"
+#include "binaryio.h"
+
+static constexpr char MAGIC[8] = {'K', 'D', 'G', 'T', 'I', 'D', 'X', '\0'};
+
+static bool statTar(const std::filesystem::path& path, uint64_t& size, int64_t& mtime)
+{
+	std::error_code ec;
+	size = std::filesystem::file_size(path, ec);
+	if(ec)
+		return false;
+	std::filesystem::file_time_type time = std::filesystem::last_write_time(path, ec);
+	if(ec)
+		return false;
+	mtime = time.time_since_epoch().count();
+	return true;
+}
+
+std::filesystem::path TarIndex::indexPath(const std::filesystem::path& tarPath)
+{
+	return tarPath.string() + ".idx";
+}
+
+void TarIndex::addLocked(const Entry& entry, uint64_t base)
+{
+	auto model = modelIds.find(entry.model);
+	if(model == modelIds.end())
+	{
+		model = modelIds.insert({entry.model, models.size()}).first;
+		models.push_back(entry.model);
+	}
+
+	auto labelSet = labelSetIds.find(entry.labelNames);
+	if(labelSet == labelSetIds.end())
+	{
+		labelSet = labelSetIds.insert({entry.labelNames, labelSets.size()}).first;
+		labelSets.push_back(entry.labelNames);
+	}
+
+	members.push_back({entry.name, base + entry.headerOffset, base + entry.dataOffset, entry.size, model->second, labelSet->second});
+}
+
+void TarIndex::add(const Entry& entry, uint64_t base)
+{
+	std::scoped_lock lock(mutex);
+	addLocked(entry, base);
+}
+
+void TarIndex::add(const std::vector<Entry>& entries, uint64_t base)
+{
+	std::scoped_lock lock(mutex);
+	for(const Entry& entry : entries)
+		addLocked(entry, base);
+}
+
+bool TarIndex::save(const std::filesystem::path& tarPath)
+{
+	std::scoped_lock lock(mutex);
+
+	uint64_t tarSize;
+	int64_t mtime;
+	if(!statTar(tarPath, tarSize, mtime))
+	{
+		Log(Log::WARN)<<"Could not stat "<<tarPath<<", not writeing an index";
+		return false;
+	}
+
+	// Keep members in archive order so that loading assigns classes like a scan would
+	std::sort(members.begin(), members.end(), [](const Member& a, const Member& b){return a.headerOffset < b.headerOffset;});
+
+	std::string out(MAGIC, sizeof(MAGIC));
+	putU32(out, VERSION);
+	putU64(out, tarSize);
+	putU64(out, static_cast<uint64_t>(mtime));
+
+	putU32(out, models.size());
+	for(const std::string& model : models)
+		putString(out, model);
+
+	putU32(out, labelSets.size());
+	for(const std::vector<std::string>& labelSet : labelSets)
+	{
+		putU32(out, labelSet.size());
+		for(const std::string& name : labelSet)
+			putString(out, name);
+	}
+
+	putU64(out, members.size());
+	for(const Member& member : members)
+	{
+		putString(out, member.name);
+		putU64(out, member.headerOffset);
+		putU64(out, member.dataOffset);
+		putU64(out, member.size);
+		putU32(out, member.model);
+		putU32(out, member.labelSet);
+	}
+
+	// Write to a temporary file first so that a reader never sees a partial index
+	std::filesystem::path path = indexPath(tarPath);
+	std::filesystem::path tmpPath = path.string() + ".tmp";
+	{
+		std::ofstream file(tmpPath, std::ios::binary | std::ios::trunc);
+		if(!file.is_open() || !file.write(out.data(), out.size()))
+		{
+			Log(Log::WARN)<<"Could not write index "<<tmpPath;
+			return false;
+		}
+	}
+
+	std::error_code ec;
+	std::filesystem::rename(tmpPath, path, ec);
+	if(ec)
+	{
+		Log(Log::WARN)<<"Could not write index "<<path<<": "<<ec.message();
+		std::filesystem::remove(tmpPath, ec);
+		return false;
+	}
+	return true;
+}
+
+bool TarIndex::load(const std::filesystem::path& tarPath)
+{
+	std::filesystem::path path = indexPath(tarPath);
+	std::ifstream file(path, std::ios::binary);
+	if(!file.is_open())
+		return false;
+
+	std::string data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+	BinaryReader reader(data.data(), data.size());
+
+	if(!reader.expect(MAGIC, sizeof(MAGIC)) || reader.u32() != VERSION)
+	{
+		Log(Log::WARN)<<path<<" is not a index of a supported version";
+		return false;
+	}
+
+	uint64_t tarSize;
+	int64_t mtime;
+	uint64_t indexedSize = reader.u64();
+	int64_t indexedMtime = static_cast<int64_t>(reader.u64());
+	if(!statTar(tarPath, tarSize, mtime) || tarSize != indexedSize || mtime != indexedMtime)
+	{
+		Log(Log::INFO)<<path<<" is stale";
+		return false;
+	}
+
+	std::scoped_lock lock(mutex);
+	members.clear();
+	models.clear();
+	modelIds.clear();
+	labelSets.clear();
+	labelSetIds.clear();
+
+	uint32_t modelCount = reader.u32();
+	for(uint32_t i = 0; i < modelCount && !reader.fail(); ++i)
+	{
+		models.push_back(reader.string());
+		modelIds.insert({models.back(), i});
+	}
+
+	uint32_t labelSetCount = reader.u32();
+	for(uint32_t i = 0; i < labelSetCount && !reader.fail(); ++i)
+	{
+		std::vector<std::string> labelSet(reader.u32());
+		for(std::string& name : labelSet)
+			name = reader.string();
+		labelSets.push_back(labelSet);
+		labelSetIds.insert({labelSet, i});
+	}
+
+	uint64_t memberCount = reader.u64();
+	if(!reader.fail())
+		members.reserve(std::min<uint64_t>(memberCount, data.size()/32));
+	for(uint64_t i = 0; i < memberCount && !reader.fail(); ++i)
+	{
+		Member member;
+		member.name = reader.string();
+		member.headerOffset = reader.u64();
+		member.dataOffset = reader.u64();
+		member.size = reader.u64();
+		member.model = reader.u32();
+		member.labelSet = reader.u32();
+		if(member.model >= models.size() || member.labelSet >= labelSets.size() || member.dataOffset + member.size > tarSize)
+			break;
+		members.push_back(member);
+	}
+
+	if(reader.fail() || members.size() != memberCount || !reader.atEnd())
+	{
+		Log(Log::WARN)<<path<<" is corrupt";
+		members.clear();
+		return false;
+	}
+	return true;
+}
+
+const std::vector<TarIndex::Member>& TarIndex::getMembers() const
+{
+	return members;
+}
+
+const std::vector<std::string>& TarIndex::getModels() const
+{
+	return models;
+}
+
+const std::vector<std::vector<std::string>>& TarIndex::getLabelSets() const
+{
+	return labelSets;
+}
@@ -0,0 +1,92 @@
+/* * KissDatasetGenerator - A generator of datasets for TorchKissAnn
+ * Copyright (C) 2025 Carl Klemm <carl@uvos.xyz>
+ *
+ * This file is part of KissDatasetGenerator.
+ *
+ * KissDatasetGenerator is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * KissDatasetGenerator is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with KissDatasetGenerator.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <map>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <filesystem>
+
+/*
+ * Binary sidecar index for tar archives, stored next to the archive as <archive>.idx.
+ * For every spectrum member it records the member name, the offset of its header
+ * and of its data, the data size and ids into a table of model strings and a table
+ * of label name sets, so that TarDataset can open an archive without parsing every member.
+ * The index records size and modification time of the archive it describes and is
+ * considered stale if either no longer matches.
+ */
+class TarIndex
+{
+public:
+	struct Entry
+	{
+		std::string name;
+		uint64_t headerOffset;
+		uint64_t dataOffset;
+		uint64_t size;
+		std::string model;
+		std::vector<std::string> labelNames;
+	};
+
+	struct Member
+	{
+		std::string name;
+		uint64_t headerOffset;
+		uint64_t dataOffset;
+		uint64_t size;
+		uint32_t model;
+		uint32_t labelSet;
+	};
+
+private:
+	std::mutex mutex;
+	std::vector<Member> members;
+	std::vector<std::string> models;
+	std::unordered_map<std::string, uint32_t> modelIds;
+	std::vector<std::vector<std::string>> labelSets;
+	std::map<std::vector<std::string>, uint32_t> labelSetIds;
+
+	void addLocked(const Entry& entry, uint64_t base);
+
+public:
+	static constexpr uint32_t VERSION = 1;
+
+	TarIndex() = default;
+	TarIndex(const TarIndex& in) = delete;
+	TarIndex& operator=(const TarIndex& in) = delete;
+
+	// Adds entries whose offsets are relative to base, thread safe
+	void add(const Entry& entry, uint64_t base = 0);
+	void add(const std::vector<Entry>& entries, uint64_t base = 0);
+
+	// Writes the index for the archive at tarPath, the archive must not be modified afterwards
+	bool save(const std::filesystem::path& tarPath);
+	// Loads the index of the archive at tarPath, fails if it is missing, corrupt or stale
+	bool load(const std::filesystem::path& tarPath);
+
+	const std::vector<Member>& getMembers() const;
+	const std::vector<std::string>& getModels() const;
+	const std::vector<std::vector<std::string>>& getLabelSets() const;
+
+	static std::filesystem::path indexPath(const std::filesystem::path& tarPath);
+};
@@ -0,0 +1,348 @@
+//
+// KissDatasetGenerator - A generator of datasets for TorchKissAnn
+// Copyright (C) 2025 Carl Klemm <carl@uvos.xyz>
+//
+// This file is part of KissDatasetGenerator.
+//
+// KissDatasetGenerator is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// KissDatasetGenerator is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with KissDatasetGenerator.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include "tarwriter.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/uio.h>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include <iomanip>
+#include <sstream>
+
+#include "microtar.h"
+#include "log.h"
+
+static size_t roundUp(size_t n, size_t incr)
+{
+	return n + (incr - n % incr) % incr;
+}
+
+static const char zeroBlock[MTAR_BLOCKSIZE] = {};
+
+TarWriter::TarWriter(const std::filesystem::path& path, bool append):
+path(path)
+{
+	fd = open(path.c_str(), O_WRONLY | O_CREAT | (append ? 0 : O_TRUNC), 0664);
+	if(fd < 0)
+	{
+		Log(Log::ERROR)<<"Could not open "<<path<<": "<<strerror(errno);
+		return;
+	}
+
+	if(append)
+	{
+		off_t end = lseek(fd, 0, SEEK_END);
+		if(end < 0 || end % MTAR_BLOCKSIZE != 0)
+		{
+			Log(Log::ERROR)<<path<<" is not a unfinalized tar archive";
+			close(fd);
+			fd = -1;
+			return;
+		}
+		offset = end;
+
+		// Only keep indexing if the index covers the existing content
+		indexValid = index.load(path);
+	}
+}
+
+TarWriter::~TarWriter()
+{
+	if(fd >= 0)
+	{
+		close(fd);
+		if(indexValid)
+			index.save(path);
+	}
+}
+
+bool TarWriter::isOpen() const
+{
+	return fd >= 0;
+}
+
+const std::filesystem::path& TarWriter::getPath() const
+{
+	return path;
+}
+
+uint64_t TarWriter::getSize() const
+{
+	return offset.load();
+}
+
+size_t TarWriter::memberSize(const std::string& name, size_t size)
+{
+	return mtar_file_header_size(name.c_str(), size) + roundUp(size, MTAR_BLOCKSIZE);
+}
+
+bool TarWriter::writeAt(const char* data, size_t size, uint64_t pos)
+{
+	while(size > 0)
+	{
+		ssize_t ret = pwrite(fd, data, size, pos);
+		if(ret < 0)
+		{
+			if(errno == EINTR)
+				continue;
+			Log(Log::ERROR)<<"Could not write to "<<path<<": "<<strerror(errno);
+			indexValid = false;
+			return false;
+		}
+		data += ret;
+		pos += ret;
+		size -= ret;
+	}
+	return true;
+}
+
+bool TarWriter::writeAt(struct iovec* iov, int iovcnt, uint64_t pos)
+{
+	while(iovcnt > 0)
+	{
+		ssize_t ret = pwritev(fd, iov, iovcnt, pos);
+		if(ret < 0)
+		{
+			if(errno == EINTR)
+				continue;
+			Log(Log::ERROR)<<"Could not write to "<<path<<": "<<strerror(errno);
+			indexValid = false;
+			return false;
+		}
+		pos += ret;
+
+		// Skip what was written, a short write may end in the middle of a vector
+		while(iovcnt > 0 && static_cast<size_t>(ret) >= iov->iov_len)
+		{
+			ret -= iov->iov_len;
+			++iov;
+			--iovcnt;
+		}
+		if(iovcnt > 0)
+		{
+			iov->iov_base = static_cast<char*>(iov->iov_base) + ret;
+			iov->iov_len -= ret;
+		}
+	}
+	return true;
+}
+
+bool TarWriter::writeFile(const std::string& name, const char* data, size_t size, const eis::Spectra* spectrum)
+{
+	thread_local std::vector<char> header;
+
+	size_t headerSize = mtar_file_header_size(name.c_str(), size);
+	if(headerSize == 0)
+	{
+		Log(Log::ERROR)<<"Can not store "<<name<<" in "<<path<<" as the name is too long";
+		return false;
+	}
+
+	header.resize(headerSize);
+	if(mtar_format_file_header(header.data(), name.c_str(), size) != MTAR_ESUCCESS)
+		return false;
+
+	size_t padding = roundUp(size, MTAR_BLOCKSIZE) - size;
+	struct iovec iov[3];
+	iov[0].iov_base = header.data();
+	iov[0].iov_len = headerSize;
+	iov[1].iov_base = const_cast<char*>(data);
+	iov[1].iov_len = size;
+	iov[2].iov_base = const_cast<char*>(zeroBlock);
+	iov[2].iov_len = padding;
+
+	uint64_t pos = offset.fetch_add(headerSize + size + padding, std::memory_order_relaxed);
+	if(!writeAt(iov, padding > 0 ? 3 : 2, pos))
+		return false;
+
+	if(spectrum)
+		index.add({name, 0, headerSize, size, spectrum->model, spectrum->labelNames}, pos);
+	return true;
+}
+
+bool TarWriter::writeFile(const std::string& name, const std::string& data, const eis::Spectra* spectrum)
+{
+	return writeFile(name, data.c_str(), data.size(), spectrum);
+}
+
+bool TarWriter::writeMembers(const char* data, size_t size, const std::vector<TarIndex::Entry>& entries)
+{
+	uint64_t pos = offset.fetch_add(size, std::memory_order_relaxed);
+	if(!writeAt(data, size, pos))
+		return false;
+
+	if(!entries.empty())
+		index.add(entries, pos);
+	return true;
+}
+
+bool TarWriter::finalize()
+{
+	struct iovec iov[2];
+	iov[0].iov_base = const_cast<char*>(zeroBlock);
+	iov[0].iov_len = MTAR_BLOCKSIZE;
+	iov[1] = iov[0];
+	uint64_t pos = offset.fetch_add(MTAR_BLOCKSIZE*2);
+	return writeAt(iov, 2, pos);
+}
+
+BufferedTarWriter::BufferedTarWriter(TarWriter* writer, size_t capacity):
+writer(writer), capacity(roundUp(capacity, MTAR_BLOCKSIZE))
+{
+	long pageSize = sysconf(_SC_PAGESIZE);
+	if(pageSize <= 0)
+		pageSize = 4096;
+
+	// aligned_alloc requires the size to be a multiple of the alignment
+	buffer = static_cast<char*>(std::aligned_alloc(pageSize, roundUp(this->capacity, pageSize)));
+	if(!buffer)
+	{
+		Log(Log::WARN)<<"Could not allocate write buffer for "<<writer->getPath()<<", writeing unbuffered";
+		this->capacity = 0;
+	}
+}
+
+BufferedTarWriter::~BufferedTarWriter()
+{
+	flush();
+	std::free(buffer);
+}
+
+bool BufferedTarWriter::writeFile(const std::string& name, const char* data, size_t size, const eis::Spectra* spectrum)
+{
+	size_t headerSize = mtar_file_header_size(name.c_str(), size);
+	if(headerSize == 0)
+	{
+		Log(Log::ERROR)<<"Can not store "<<name<<" in "<<writer->getPath()<<" as the name is too long";
+		return false;
+	}
+
+	size_t memberSize = headerSize + roundUp(size, MTAR_BLOCKSIZE);
+	if(memberSize > capacity - used)
+	{
+		if(!flush())
+			return false;
+		if(memberSize > capacity)
+			return writer->writeFile(name, data, size, spectrum);
+	}
+
+	char* member = buffer + used;
+	if(mtar_format_file_header(member, name.c_str(), size) != MTAR_ESUCCESS)
+		return false;
+	std::memcpy(member + headerSize, data, size);
+	std::memset(member + headerSize + size, 0, memberSize - headerSize - size);
+	if(spectrum)
+		entries.push_back({name, used, used + headerSize, size, spectrum->model, spectrum->labelNames});
+	used += memberSize;
+	return true;
+}
+
+bool BufferedTarWriter::writeFile(const std::string& name, const std::string& data, const eis::Spectra* spectrum)
+{
+	return writeFile(name, data.c_str(), data.size(), spectrum);
+}
+
+bool BufferedTarWriter::flush()
+{
+	if(used == 0)
+		return true;
+	bool ret = writer->writeMembers(buffer, used, entries);
+	used = 0;
+	entries.clear();
+	return ret;
+}
+
+uint64_t BufferedTarWriter::getSize() const
+{
+	return writer->getSize() + used;
+}
+
+const std::filesystem::path& BufferedTarWriter::getPath() const
+{
+	return writer->getPath();
+}
+
+ShardedTarWriter::ShardedTarWriter(const std::string& prefix, std::atomic<size_t>* shardCounter, size_t maxBytes):
+prefix(prefix), shardCounter(shardCounter), maxBytes(maxBytes)
+{
+}
+
+ShardedTarWriter::~ShardedTarWriter()
+{
+	close();
+}
+
+bool ShardedTarWriter::openShard()
+{
+	close();
+
+	std::stringstream ss;
+	ss<<prefix<<'-'<<std::setw(5)<<std::setfill('0')<<shardCounter->fetch_add(1)<<".tar";
+
+	current = new TarWriter(ss.str());
+	if(!current->isOpen())
+	{
+		delete current;
+		current = nullptr;
+		return false;
+	}
+	buffered = new BufferedTarWriter(current);
+
+	ShardInfo shard;
+	shard.path = ss.str();
+	shards.push_back(shard);
+	return true;
+}
+
+bool ShardedTarWriter::writeFile(const std::string& name, const std::string& data, const eis::Spectra* spectrum)
+{
+	if(!current || (shards.back().size > 0 && buffered->getSize() + TarWriter::memberSize(name, data.size()) > maxBytes))
+	{
+		if(!openShard())
+			return false;
+	}
+
+	bool ret = buffered->writeFile(name, data, spectrum);
+	if(ret)
+		++shards.back().size;
+	return ret;
+}
+
+void ShardedTarWriter::close()
+{
+	delete buffered;
+	buffered = nullptr;
+	delete current;
+	current = nullptr;
+}
+
+const std::vector<ShardInfo>& ShardedTarWriter::getShards() const
+{
+	return shards;
+}
+
+std::filesystem::path ShardedTarWriter::getPath() const
+{
+	return current ? current->getPath() : std::filesystem::path(prefix);
+}
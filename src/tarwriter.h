@@ -0,0 +1,138 @@
+/* * KissDatasetGenerator - A generator of datasets for TorchKissAnn
+ * Copyright (C) 2025 Carl Klemm <carl@uvos.xyz>
+ *
+ * This file is part of KissDatasetGenerator.
+ *
+ * KissDatasetGenerator is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * KissDatasetGenerator is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with KissDatasetGenerator.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <vector>
+#include <filesystem>
+
+#include <kisstype/spectra.h>
+
+#include "shardinfo.h"
+#include "tarindex.h"
+
+struct iovec;
+
+/*
+ * Tar archive writer that can be used from many threads at once.
+ * The region a member will occupy in the archive is reserved with an atomic fetch-add
+ * and header, payload and padding are then written with a single pwritev,
+ * so no lock is held while writeing.
+ * Members written together with the spectrum they contain are recorded in a TarIndex
+ * that is saved next to the archive when the writer is destroyed.
+ */
+class TarWriter
+{
+	int fd = -1;
+	std::atomic<uint64_t> offset = 0;
+	std::filesystem::path path;
+	TarIndex index;
+	std::atomic<bool> indexValid = true;
+
+	bool writeAt(const char* data, size_t size, uint64_t pos);
+	bool writeAt(struct iovec* iov, int iovcnt, uint64_t pos);
+
+public:
+	// If append is set members are added after the existing content of an unfinalized archive
+	explicit TarWriter(const std::filesystem::path& path, bool append = false);
+	TarWriter(const TarWriter& in) = delete;
+	TarWriter& operator=(const TarWriter& in) = delete;
+	~TarWriter();
+
+	bool isOpen() const;
+	bool writeFile(const std::string& name, const char* data, size_t size, const eis::Spectra* spectrum = nullptr);
+	bool writeFile(const std::string& name, const std::string& data, const eis::Spectra* spectrum = nullptr);
+
+	// Appends size bytes of already formated, block aligned members to the archive,
+	// the offsets of the index entries are relative to the start of data
+	bool writeMembers(const char* data, size_t size, const std::vector<TarIndex::Entry>& entries = {});
+
+	// Appends the end of archive marker, must only be called once all writeing threads are done
+	bool finalize();
+	const std::filesystem::path& getPath() const;
+	uint64_t getSize() const;
+
+	static size_t memberSize(const std::string& name, size_t size);
+};
+
+/*
+ * Collects the members written by one thread in a large, page aligned buffer
+ * and hands them to the underlying TarWriter in one reservation and one pwrite
+ * once the buffer is full. Members that do not fit into the buffer are passed
+ * through to TarWriter::writeFile directly.
+ * A BufferedTarWriter must only be used by a single thread and must be flushed
+ * before the underlying TarWriter is finalized.
+ */
+class BufferedTarWriter
+{
+	TarWriter* writer;
+	char* buffer;
+	size_t capacity;
+	size_t used = 0;
+	std::vector<TarIndex::Entry> entries;
+
+public:
+	static constexpr size_t DEFAULT_CAPACITY = 4*1024*1024;
+
+	explicit BufferedTarWriter(TarWriter* writer, size_t capacity = DEFAULT_CAPACITY);
+	BufferedTarWriter(const BufferedTarWriter& in) = delete;
+	BufferedTarWriter& operator=(const BufferedTarWriter& in) = delete;
+	~BufferedTarWriter();
+
+	bool writeFile(const std::string& name, const char* data, size_t size, const eis::Spectra* spectrum = nullptr);
+	bool writeFile(const std::string& name, const std::string& data, const eis::Spectra* spectrum = nullptr);
+	bool flush();
+	// Size of the archive including the members still held in the buffer
+	uint64_t getSize() const;
+	const std::filesystem::path& getPath() const;
+};
+
+/*
+ * Writes tar members into a sequence of archives named prefix-00000.tar, prefix-00001.tar, ...
+ * starting a new archive once the current one would exceed maxBytes.
+ * A ShardedTarWriter is meant to be owned by a single thread, the shard numbers are drawn
+ * from a counter that can be shared between threads.
+ * Shards are left unfinalized, so that members describeing the whole set of shards can
+ * be appended once all shards are known.
+ */
+class ShardedTarWriter
+{
+	std::string prefix;
+	std::atomic<size_t>* shardCounter;
+	size_t maxBytes;
+	TarWriter* current = nullptr;
+	BufferedTarWriter* buffered = nullptr;
+	std::vector<ShardInfo> shards;
+
+	bool openShard();
+
+public:
+	ShardedTarWriter(const std::string& prefix, std::atomic<size_t>* shardCounter, size_t maxBytes);
+	ShardedTarWriter(const ShardedTarWriter& in) = delete;
+	ShardedTarWriter& operator=(const ShardedTarWriter& in) = delete;
+	~ShardedTarWriter();
+
+	bool writeFile(const std::string& name, const std::string& data, const eis::Spectra* spectrum = nullptr);
+	void close();
+	const std::vector<ShardInfo>& getShards() const;
+	std::filesystem::path getPath() const;
+};
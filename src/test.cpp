@@ -19,13 +19,381 @@
 //
 
 #include <iostream>
+#include <sstream>
+#include <algorithm>
+#include <cmath>
+#include <iomanip>
+#include <string>
 #include <vector>
-#include <memory>
+#include <kisstype/spectra.h>
+
+#include <cstring>
+#include <fstream>
+#include <filesystem>
+
+#include "spectraparser.h"
+#include "mappedfile.h"
+#include "drtscreen.h"
+#include "sweepstore.h"
+
+/*
+ * spectraparser: checks that the fast parser in spectraparser.cpp reads every field of a
+ * spectrum exactly like eis::Spectra::loadFromStream does. The test files are written with
+ * eis::Spectra::saveToStream and then varied in the ways real measurement archives
+ * differ from it.
+ * drtscreen: checks that the drt prescreen keeps spectra whose arcs close inside the
+ * frequency range and rejects those that are cut off.
+ * sweepstore: checks that a sweep store with a damaged tail can still be added to.
+ * Run without arguments to run all tests or give the names of the tests to run.
+ */
+
+static std::vector<std::string> splitLines(const std::string& str)
+{
+	std::vector<std::string> lines;
+	std::stringstream ss(str);
+	std::string line;
+	while(std::getline(ss, line))
+		lines.push_back(line);
+	return lines;
+}
+
+static std::string joinLines(const std::vector<std::string>& lines, const std::string& newline)
+{
+	std::string out;
+	for(const std::string& line : lines)
+		out.append(line).append(newline);
+	return out;
+}
+
+static eis::Spectra makeSpectra(size_t points, size_t labelCount, size_t labelNameLength)
+{
+	std::vector<eis::DataPoint> data;
+	for(size_t i = 0; i < points; ++i)
+	{
+		fvalue omega = std::pow(10.0, i*7.0/std::max<size_t>(points, 2));
+		data.push_back(eis::DataPoint(std::complex<fvalue>(100.0/(i+1) + 0.1234567*i, -1e-3*i*i - 7.5e-9), omega));
+	}
+
+	eis::Spectra spectra(data, "r{1.5e2}-r{3.3e3}c{1.2e-6}", "measured at 25C");
+	std::vector<std::string> labelNames;
+	std::vector<double> labels;
+	for(size_t i = 0; i < labelCount; ++i)
+	{
+		std::string name = "label_" + std::to_string(i) + "_";
+		name.append(labelNameLength > name.size() ? labelNameLength - name.size() : 0, 'a' + i%26);
+		labelNames.push_back(name);
+		labels.push_back(i*0.731 - 3.0);
+	}
+	spectra.labelNames = labelNames;
+	spectra.setLabels(labels);
+	return spectra;
+}
+
+static std::string serialize(const eis::Spectra& spectra)
+{
+	std::stringstream ss;
+	spectra.saveToStream(ss);
+	return ss.str();
+}
+
+// Rewrites the data rows, which are the last lines of a serialized spectrum, in scientific notation
+static std::string toScientific(const eis::Spectra& spectra)
+{
+	std::vector<std::string> lines = splitLines(serialize(spectra));
+	size_t firstRow = lines.size() - spectra.data.size();
+	for(size_t i = 0; i < spectra.data.size(); ++i)
+	{
+		std::stringstream row;
+		row<<std::scientific<<std::setprecision(9)<<spectra.data[i].omega<<','<<std::setprecision(6)
+			<<spectra.data[i].im.real()<<", "<<std::uppercase<<spectra.data[i].im.imag();
+		lines[firstRow + i] = row.str();
+	}
+	return joinLines(lines, "\n");
+}
+
+static bool compare(const std::string& name, const eis::Spectra& fast, const eis::Spectra& slow, bool headerOnly)
+{
+	std::vector<std::string> errors;
+	if(fast.model != slow.model)
+		errors.push_back("model \"" + fast.model + "\" != \"" + slow.model + '"');
+	if(fast.header != slow.header)
+		errors.push_back("header \"" + fast.header + "\" != \"" + slow.header + '"');
+	if(fast.labelNames != slow.labelNames)
+		errors.push_back("label names differ");
+	if(fast.labels != slow.labels)
+		errors.push_back("labels differ");
+
+	size_t expectedSize = headerOnly ? std::min<size_t>(slow.data.size(), 1) : slow.data.size();
+	if(fast.data.size() != expectedSize)
+	{
+		errors.push_back("size " + std::to_string(fast.data.size()) + " != " + std::to_string(expectedSize));
+	}
+	else
+	{
+		for(size_t i = 0; i < fast.data.size(); ++i)
+		{
+			if(fast.data[i].omega != slow.data[i].omega || fast.data[i].im != slow.data[i].im)
+			{
+				errors.push_back("row " + std::to_string(i) + " differs");
+				break;
+			}
+		}
+	}
+
+	for(const std::string& error : errors)
+		std::cerr<<name<<(headerOnly ? " (header)" : "")<<": "<<error<<'\n';
+	return errors.empty();
+}
+
+static bool check(const std::string& name, const std::string& csv)
+{
+	eis::Spectra slow;
+	try
+	{
+		MemoryStream ss(csv.data(), csv.size());
+		slow = eis::Spectra::loadFromStream(ss);
+	}
+	catch(const eis::file_error& err)
+	{
+		// Input kisstype rejects has to be rejected by the fast parser too
+		bool rejected = false;
+		try
+		{
+			parseSpectra(csv.data(), csv.size());
+		}
+		catch(const eis::file_error& err)
+		{
+			rejected = true;
+		}
+		std::cout<<(rejected ? "PASS " : "FAIL ")<<name<<" (rejected by loadFromStream)\n";
+		return rejected;
+	}
+
+	eis::Spectra fast = parseSpectra(csv.data(), csv.size());
+	bool ret = compare(name, fast, slow, false);
+
+	eis::Spectra header;
+	if(slow.data.size() > 1)
+	{
+		if(!parseSpectraHeader(csv.data(), csv.size(), header))
+		{
+			std::cerr<<name<<": parseSpectraHeader did not recognize the layout\n";
+			ret = false;
+		}
+		else
+		{
+			ret = compare(name, header, slow, true) && ret;
+		}
+	}
+
+	std::cout<<(ret ? "PASS " : "FAIL ")<<name<<'\n';
+	return ret;
+}
+
+static bool testParser()
+{
+	eis::Spectra plain = makeSpectra(50, 0, 0);
+	eis::Spectra labeled = makeSpectra(50, 5, 8);
+	eis::Spectra longLabels = makeSpectra(100, 200, 300);
+	eis::Spectra single = makeSpectra(1, 3, 8);
+	eis::Spectra threeLabels = makeSpectra(50, 3, 8);
+
+	// Without the column names the label values sit directly above the rows
+	std::vector<std::string> noColumnNames = splitLines(serialize(threeLabels));
+	noColumnNames.erase(noColumnNames.end() - threeLabels.data.size() - 1);
+
+	std::vector<std::pair<std::string, std::string>> cases = {
+		{"plain", serialize(plain)},
+		{"labels", serialize(labeled)},
+		{"long labels", serialize(longLabels)},
+		{"single row", serialize(single)},
+		{"three labels", serialize(threeLabels)},
+		{"three labels scientific", toScientific(threeLabels)},
+		{"three labels without column names", joinLines(noColumnNames, "\n")},
+		{"crlf", joinLines(splitLines(serialize(labeled)), "\r\n")},
+		{"crlf long labels", joinLines(splitLines(serialize(longLabels)), "\r\n")},
+		{"scientific", toScientific(labeled)},
+		{"scientific crlf", joinLines(splitLines(toScientific(longLabels)), "\r\n")},
+		{"trailing newlines", serialize(labeled) + "\n\n"},
+		{"no final newline", serialize(plain).substr(0, serialize(plain).size()-1)},
+	};
+
+	bool ret = true;
+	for(const std::pair<std::string, std::string>& testCase : cases)
+	{
+		try
+		{
+			ret = check(testCase.first, testCase.second) && ret;
+		}
+		catch(const eis::file_error& err)
+		{
+			std::cerr<<testCase.first<<": "<<err.what()<<'\n';
+			std::cout<<"FAIL "<<testCase.first<<'\n';
+			ret = false;
+		}
+	}
+
+	return ret;
+}
+
+// Impedance of a resistor in series with a resistor and capacitor in parallel over 10 to 1e6 rad/s
+static std::vector<eis::DataPoint> seriesRc(double rSeries, double r, double c, bool ascending = true)
+{
+	constexpr size_t POINTS = 50;
+	std::vector<eis::DataPoint> data;
+	for(size_t i = 0; i < POINTS; ++i)
+	{
+		double omega = std::pow(10.0, 1 + 5.0*i/(POINTS-1));
+		std::complex<double> z = rSeries + r/(1.0 + std::complex<double>(0, omega*r*c));
+		data.push_back(eis::DataPoint(std::complex<fvalue>(z), omega));
+	}
+	if(!ascending)
+		std::reverse(data.begin(), data.end());
+	return data;
+}
+
+static bool testDrtScreen()
+{
+	struct ScreenCase
+	{
+		std::string name;
+		std::vector<eis::DataPoint> data;
+		DrtScreenResult expected;
+	};
+
+	std::vector<ScreenCase> cases = {
+		{"r||c", seriesRc(0, 100, 1e-6), DRT_SCREEN_PASS},
+		{"r-(r||c)", seriesRc(50, 100, 1e-6), DRT_SCREEN_PASS},
+		{"r-(r||c) descending", seriesRc(50, 100, 1e-6, false), DRT_SCREEN_PASS},
+		{"r||c open at the high side", seriesRc(0, 100, 1e-9), DRT_SCREEN_HIGH_SIDE},
+		{"r||c open at the low side", seriesRc(0, 100, 1e-1), DRT_SCREEN_LOW_SIDE},
+		{"r-(r||c) open at the high side descending", seriesRc(50, 100, 1e-9, false), DRT_SCREEN_HIGH_SIDE},
+		{"r", seriesRc(100, 0, 1e-6), DRT_SCREEN_EMPTY},
+	};
+
+	bool ret = true;
+	for(const ScreenCase& screenCase : cases)
+	{
+		DrtScreenResult result = screenDrtCandidate(screenCase.data);
+		if(result != screenCase.expected)
+			std::cerr<<screenCase.name<<": screened as "<<result<<" instead of "<<screenCase.expected<<'\n';
+		std::cout<<(result == screenCase.expected ? "PASS " : "FAIL ")<<screenCase.name<<'\n';
+		ret = ret && result == screenCase.expected;
+	}
+	return ret;
+}
+
+static SweepStore::Sweep makeSweep(size_t seed)
+{
+	SweepStore::Sweep sweep;
+	sweep.data = seriesRc(seed, 100, 1e-6);
+	sweep.modelStr = "r{" + std::to_string(seed) + "}-r{100}c{1e-6}";
+	sweep.labels = {static_cast<fvalue>(seed), 100, 1e-6};
+	return sweep;
+}
+
+static bool sameSweep(const SweepStore::Sweep& a, const SweepStore::Sweep& b)
+{
+	if(a.modelStr != b.modelStr || a.labels != b.labels || a.data.size() != b.data.size())
+		return false;
+	for(size_t i = 0; i < a.data.size(); ++i)
+	{
+		if(a.data[i].omega != b.data[i].omega || a.data[i].im != b.data[i].im)
+			return false;
+	}
+	return true;
+}
+
+// Writes one record, damages the end of the store with tail, then adds a second record
+// and checks that both are found after reopening the store
+static bool checkStoreTail(const std::string& name, const std::string& tail)
+{
+	std::filesystem::path path = std::filesystem::temp_directory_path()/"kissdatasetgenerator-test.store";
+	std::filesystem::remove(path);
+
+	{
+		SweepStore store(path);
+		store.add("first", makeSweep(1));
+	}
+	uintmax_t validSize = std::filesystem::file_size(path);
+	{
+		std::ofstream file(path, std::ios::binary | std::ios::app);
+		file.write(tail.data(), tail.size());
+	}
+	{
+		SweepStore store(path);
+		store.add("second", makeSweep(2));
+	}
+
+	SweepStore store(path);
+	SweepStore::Sweep first;
+	SweepStore::Sweep second;
+	std::vector<std::string> errors;
+	if(store.size() != 2)
+		errors.push_back("store holds " + std::to_string(store.size()) + " records instead of 2");
+	if(!store.find("first", first) || !sameSweep(first, makeSweep(1)))
+		errors.push_back("the record written before the damage is lost");
+	if(!store.find("second", second) || !sameSweep(second, makeSweep(2)))
+		errors.push_back("the record appended after the damage can not be found");
+	if(std::filesystem::file_size(path) <= validSize)
+		errors.push_back("nothing was appended");
+	std::filesystem::remove(path);
+
+	for(const std::string& error : errors)
+		std::cerr<<name<<": "<<error<<'\n';
+	std::cout<<(errors.empty() ? "PASS " : "FAIL ")<<name<<'\n';
+	return errors.empty();
+}
+
+static bool testSweepStore()
+{
+	// A record header announceing a payload that was never written, as left by a killed process
+	std::string torn("\x00\x10\x00\x00\x01\x02\x03\x04\x05\x06\x07\x08" "partial", 19);
+	// A complete record whose checksum does not match its payload
+	std::string corrupt("\x04\x00\x00\x00\x01\x02\x03\x04\x05\x06\x07\x08" "abcd", 16);
+	// Less than a record header
+	std::string stub("\x04\x00", 2);
+
+	bool ret = checkStoreTail("torn record", torn);
+	ret = checkStoreTail("corrupt record", corrupt) && ret;
+	ret = checkStoreTail("partial record header", stub) && ret;
+	return ret;
+}
+
+struct Test
+{
+	const char* name;
+	bool (*run)();
+};
+
+static const std::vector<Test> tests = {
+	{"spectraparser", testParser},
+	{"drtscreen", testDrtScreen},
+	{"sweepstore", testSweepStore},
+};
 
 int main(int argc, char** argv)
 {
-	std::vector<std::unique_ptr<int>> ids;
-	std::unique_ptr<int> anInt(new int(0));
-	ids.push_back(std::move(anInt));
-	return 1;
+	bool found = argc < 2;
+	bool ret = true;
+	for(const Test& test : tests)
+	{
+		bool selected = argc < 2;
+		for(int i = 1; i < argc; ++i)
+			selected = selected || strcmp(argv[i], test.name) == 0;
+		if(!selected)
+			continue;
+
+		found = true;
+		ret = test.run() && ret;
+	}
+
+	if(!found)
+	{
+		std::cerr<<"Available tests:\n";
+		for(const Test& test : tests)
+			std::cerr<<'\t'<<test.name<<'\n';
+		return 1;
+	}
+	return ret ? 0 : 1;
 }